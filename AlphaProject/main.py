@@ -3,11 +3,54 @@
 整合数据获取、因子计算、横截面处理和回测的完整流程
 """
 import argparse
+import json
+import resource
+import time
+from contextlib import contextmanager
+from datetime import datetime
 from pathlib import Path
 from src.data_fetch import fetch_and_save_data
 from src.factors import compute_factors_lazy, process_cross_section
-from src.backtest import run_backtest
-import polars as pl
+from src.backtest import build_selection_lazy, build_nav_lazy, summarize_nav
+
+
+class StageRecorder:
+    """
+    流程各阶段的耗时/内存记录器：
+    - 每个阶段记录墙钟时间、CPU 时间、阶段结束时的进程峰值 RSS
+      （ru_maxrss，Linux 上单位 KB，是进程级高水位）
+    - 阶段内可通过 info['rows_in'] / info['rows_out'] 登记行数
+    - 最终由 write_manifest 写出机器可读的 run_manifest.json
+    """
+    def __init__(self):
+        self.stages = []
+        self.extra = {}
+
+    @contextmanager
+    def stage(self, name):
+        info = {'name': name}
+        wall0 = time.perf_counter()
+        cpu0 = time.process_time()
+        try:
+            yield info
+        finally:
+            info['wall_seconds'] = round(time.perf_counter() - wall0, 4)
+            info['cpu_seconds'] = round(time.process_time() - cpu0, 4)
+            info['peak_rss_kb'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+            self.stages.append(info)
+            print(f"[stage] {name}: wall={info['wall_seconds']}s cpu={info['cpu_seconds']}s "
+                  f"peak_rss={info['peak_rss_kb']}KB")
+
+    def write_manifest(self, path, params: dict) -> None:
+        manifest = {
+            'generated_at': datetime.now().isoformat(),
+            'params': params,
+            'stages': self.stages,
+            **self.extra,
+        }
+        with open(path, 'w', encoding='utf-8') as f:
+            json.dump(manifest, f, ensure_ascii=False, indent=2, default=str)
+        print(f"运行清单已保存至: {path}")
 
 
 def run_full_pipeline(
@@ -17,11 +60,12 @@ def run_full_pipeline(
     end_date=None,
     data_path="./data/stocks.parquet",
     top_n=30,
-    save_results=True
+    save_results=True,
+    profile=False
 ):
     """
     运行完整的因子化流程
-    
+
     参数:
         update_data: 是否更新数据
         update_mode: "full" 全量更新 或 "incremental" 增量更新
@@ -30,102 +74,116 @@ def run_full_pipeline(
         data_path: 数据保存路径
         top_n: 选股数量（排名前N只）
         save_results: 是否保存回测结果
+        profile: 是否额外抓取 Polars 查询计划与节点级耗时（写进运行清单）
     """
+    recorder = StageRecorder()
     # 步骤1: 数据获取（可选）
-    if update_data:
-        print("=" * 60)
-        print("步骤1: 数据获取")
-        print("=" * 60)
-        fetch_and_save_data(
-            update_mode=update_mode,
-            start_date=start_date,
-            end_date=end_date,
-            data_path=data_path
-        )
-        print()
-    else:
-        # 检查数据文件是否存在
-        if not Path(data_path).exists():
-            print(f"警告: 数据文件 {data_path} 不存在，将执行数据获取...")
+    with recorder.stage("fetch"):
+        if update_data:
+            print("=" * 60)
+            print("步骤1: 数据获取")
+            print("=" * 60)
             fetch_and_save_data(
-                update_mode="full",
+                update_mode=update_mode,
                 start_date=start_date,
                 end_date=end_date,
                 data_path=data_path
             )
             print()
-    
+        else:
+            # 检查数据文件是否存在
+            if not Path(data_path).exists():
+                print(f"警告: 数据文件 {data_path} 不存在，将执行数据获取...")
+                fetch_and_save_data(
+                    update_mode="full",
+                    start_date=start_date,
+                    end_date=end_date,
+                    data_path=data_path
+                )
+                print()
+
     # 步骤2: 因子计算
-    print("=" * 60)
-    print("步骤2: 因子计算")
-    print("=" * 60)
-    print("构建因子计算图...")
-    raw_factors = compute_factors_lazy(data_path)
-    print(f"因子计算图构建完成，Schema: {raw_factors.schema}")
-    print()
-    
+    with recorder.stage("factor_graph_build"):
+        print("=" * 60)
+        print("步骤2: 因子计算")
+        print("=" * 60)
+        print("构建因子计算图...")
+        raw_factors = compute_factors_lazy(data_path)
+        print(f"因子计算图构建完成，Schema: {raw_factors.schema}")
+        print()
+
     # 步骤3: 横截面处理
-    print("=" * 60)
-    print("步骤3: 横截面处理（去极值、标准化、因子合成）")
-    print("=" * 60)
-    scored_data = process_cross_section(raw_factors)
-    print("横截面处理完成")
-    print()
-    
+    with recorder.stage("cross_section_build"):
+        print("=" * 60)
+        print("步骤3: 横截面处理（去极值、标准化、因子合成）")
+        print("=" * 60)
+        scored_data = process_cross_section(raw_factors)
+        print("横截面处理完成")
+        print()
+
     # 步骤4: 回测
     print("=" * 60)
     print("步骤4: 回测执行")
     print("=" * 60)
     print(f"选股策略: 每日选择排名前 {top_n} 只股票")
-    
-    # 选股逻辑
-    strategy_df = (
-        scored_data
-        .with_columns(
-            pl.col("score").rank(method="ordinal", descending=True).over("date").alias("rank")
-        )
-        .filter(pl.col("rank") <= top_n)
-        .group_by("date")
-        .agg([
-            pl.col("next_ret").mean().alias("strategy_ret"),
-            pl.col("code").count().alias("stock_count")
-        ])
-        .sort("date")
-        .collect()
-    )
-    
-    # 计算净值
-    df_res = strategy_df.fill_null(0)
-    pdf_res = df_res.to_pandas()
-    pdf_res["cum_nav"] = (1 + pdf_res["strategy_ret"]).cumprod()
-    
-    # 计算统计指标
-    total_return = pdf_res["cum_nav"].iloc[-1] - 1
-    annual_return = (pdf_res["cum_nav"].iloc[-1] ** (252 / len(pdf_res)) - 1) if len(pdf_res) > 0 else 0
-    sharpe_ratio = pdf_res["strategy_ret"].mean() / pdf_res["strategy_ret"].std() * (252 ** 0.5) if pdf_res["strategy_ret"].std() > 0 else 0
-    max_drawdown = ((pdf_res["cum_nav"] / pdf_res["cum_nav"].cummax()) - 1).min()
-    
+
+    # 选股 + 净值共用 src/backtest.py 里的图构建器：扫描到净值一个惰性
+    # 计划，只在下面 collect 一次，中间不落地也不过 pandas
+    strategy_lazy = build_nav_lazy(build_selection_lazy(scored_data, top_n=top_n))
+
+    with recorder.stage("collect") as info:
+        if profile:
+            # 抓取查询计划与节点级耗时（微秒），一并写入运行清单
+            recorder.extra['query_plan'] = strategy_lazy.explain()
+            strategy_df, node_timings = strategy_lazy.profile()
+            recorder.extra['node_timings'] = node_timings.to_dicts()
+        else:
+            # streaming 引擎收集，夜间全量打分内存有界（profile 分支除外，
+            # profile() 不支持 streaming）
+            strategy_df = strategy_lazy.collect(streaming=True)
+        info['rows_out'] = strategy_df.height
+
+    # 统计指标（净值列已在图内算好，小表直接汇总，无 pandas 往返）
+    with recorder.stage("nav_and_stats") as info:
+        df_res = strategy_df
+        stats = summarize_nav(df_res)
+        info['rows_out'] = df_res.height
+
     print(f"\n回测结果:")
-    print(f"  总收益率: {total_return:.2%}")
-    print(f"  年化收益率: {annual_return:.2%}")
-    print(f"  夏普比率: {sharpe_ratio:.2f}")
-    print(f"  最大回撤: {max_drawdown:.2%}")
-    print(f"  最终净值: {pdf_res['cum_nav'].iloc[-1]:.4f}")
-    print(f"  回测天数: {len(pdf_res)}")
+    print(f"  总收益率: {stats['total_return']:.2%}")
+    print(f"  年化收益率: {stats['annual_return']:.2%}")
+    print(f"  夏普比率: {stats['sharpe_ratio']:.2f}")
+    print(f"  最大回撤: {stats['max_drawdown']:.2%}")
+    print(f"  最终净值: {stats['final_nav']:.4f}")
+    print(f"  回测天数: {stats['n_days']}")
     print()
-    
+
     # 保存结果
     if save_results:
-        results_path = Path(data_path).parent / "backtest_results.parquet"
-        df_res.write_parquet(results_path)
-        print(f"回测结果已保存至: {results_path}")
-        
-        # 保存净值曲线数据
-        nav_path = Path(data_path).parent / "nav_curve.csv"
-        pdf_res[["date", "strategy_ret", "cum_nav", "stock_count"]].to_csv(nav_path, index=False)
-        print(f"净值曲线已保存至: {nav_path}")
-        print()
-    
+        with recorder.stage("save_results"):
+            results_path = Path(data_path).parent / "backtest_results.parquet"
+            df_res.write_parquet(results_path)
+            print(f"回测结果已保存至: {results_path}")
+
+            # 保存净值曲线数据
+            nav_path = Path(data_path).parent / "nav_curve.csv"
+            df_res.select(["date", "strategy_ret", "cum_nav", "stock_count"]).write_csv(nav_path)
+            print(f"净值曲线已保存至: {nav_path}")
+            print()
+
+    # 机器可读的运行清单（与 backtest_results.parquet 同目录）
+    manifest_path = Path(data_path).parent / "run_manifest.json"
+    Path(data_path).parent.mkdir(parents=True, exist_ok=True)
+    recorder.write_manifest(manifest_path, params={
+        'update_data': update_data,
+        'update_mode': update_mode,
+        'start_date': start_date,
+        'end_date': end_date,
+        'data_path': str(data_path),
+        'top_n': top_n,
+        'profile': profile,
+    })
+
     print("\n" + "=" * 60)
     print("流程完成！")
     print("=" * 60)
@@ -146,9 +204,11 @@ def main():
                        help="选股数量（排名前N只）")
     parser.add_argument("--no-save", action="store_true",
                        help="不保存回测结果")
-    
+    parser.add_argument("--profile", action="store_true",
+                       help="抓取 Polars 查询计划与节点级耗时，写入 run_manifest.json")
+
     args = parser.parse_args()
-    
+
     run_full_pipeline(
         update_data=args.update_data,
         update_mode=args.update_mode,
@@ -156,7 +216,8 @@ def main():
         end_date=args.end_date,
         data_path=args.data_path,
         top_n=args.top_n,
-        save_results=not args.no_save
+        save_results=not args.no_save,
+        profile=args.profile
     )
 
 
@@ -6,51 +6,116 @@ try:
 except ImportError:
     from factors import compute_factors_lazy, process_cross_section
 
-def run_backtest(data_path="../data/stocks.parquet", top_n=30):
+
+def top_k_mask(k: int, score_col: str = "score", by: str = "date") -> pl.Expr:
     """
-    运行回测
-    
-    参数:
-        data_path: 数据文件路径
-        top_n: 选股数量
+    每组"分数进前 k"的布尔掩码：用 top_k 的第 k 大值做阈值比较，
+    避免对全截面做总排序（~5000 行排序 vs 一次部分选择）。
+    平分时阈值上的行可能多于 k 条，由 select_top_k 在小子集上断平。
     """
-    print("构建计算图...")
-    # 1. 拿到带有因子的 LazyFrame
-    raw_factors = compute_factors_lazy(data_path)
-    
-    # 2. 清洗并打分
-    scored_data = process_cross_section(raw_factors)
+    threshold = pl.col(score_col).top_k(k).min().over(by)
+    return pl.col(score_col) >= threshold
+
 
-    # 3. 选股逻辑
-    # 每天按 score 降序排名
-    # rank(method="ordinal") 类似于 argsort
-    strategy_df = (
-        scored_data
+def select_top_k(scored: pl.LazyFrame, k: int, score_col: str = "score", by: str = "date") -> pl.LazyFrame:
+    """
+    每组取分数前 k 行（惰性，可复用于回测与实盘选股）：
+    先用阈值掩码做部分选择，再仅对幸存的 ~k 行做 ordinal 排名断平，
+    排序成本从全截面降到入选子集。
+    """
+    return (
+        scored
+        .filter(top_k_mask(k, score_col=score_col, by=by))
         .with_columns(
-            pl.col("score").rank(method="ordinal", descending=True).over("date").alias("rank")
+            pl.col(score_col).rank(method="ordinal", descending=True).over(by).alias("rank")
         )
-        # 只保留排名前 top_n 的
-        .filter(pl.col("rank") <= top_n)
-        # 计算当天的策略收益 = 持仓股票 next_ret 的平均值
+        .filter(pl.col("rank") <= k)
+    )
+
+
+def build_selection_lazy(scored_data: pl.LazyFrame, top_n: int = 30) -> pl.LazyFrame:
+    """
+    选股 + 组合日收益（惰性）：每天按 score 取前 top_n，策略收益为持仓
+    next_ret 的均值。main.py 与本模块共用这一个图，选股口径只改一处。
+    """
+    return (
+        select_top_k(scored_data, top_n)
         .group_by("date")
         .agg([
-            pl.col("next_ret").mean().alias("strategy_ret")
+            pl.col("next_ret").mean().alias("strategy_ret"),
+            pl.col("code").count().alias("stock_count"),
         ])
         .sort("date")
-        .collect() # 此时才真正触发所有计算！Rust 引擎全速运转
     )
 
-    # 4. 计算净值 (Polars 处理起来很快，但 cumprod 还是 Python 侧做图方便)
-    # 处理可能的 Null
-    df_res = strategy_df.fill_null(0)
-    
-    # 转回 Pandas 计算净值 (此时数据量只有 日期数 行，非常小)
-    pdf_res = df_res.to_pandas()
-    pdf_res["cum_nav"] = (1 + pdf_res["strategy_ret"]).cumprod()
-    
-    print("回测完成，最后净值:", pdf_res["cum_nav"].iloc[-1])
-    
-    return pdf_res
+
+def build_nav_lazy(selection_lazy: pl.LazyFrame) -> pl.LazyFrame:
+    """在选股图上接净值曲线：cum_prod 留在 Polars 内，不再经手 pandas。"""
+    return (
+        selection_lazy
+        .with_columns(pl.col("strategy_ret").fill_null(0.0))
+        .with_columns((1 + pl.col("strategy_ret")).cum_prod().alias("cum_nav"))
+    )
+
+
+def build_pipeline_lazy(data_path, top_n=30, start_date=None, end_date=None, codes=None) -> pl.LazyFrame:
+    """
+    scan -> 因子 -> 横截面 -> 选股 -> 净值 的完整惰性图。
+    全链路不落地，优化器可对整个计划做谓词下推与算子融合，collect 一次出结果。
+    """
+    raw_factors = compute_factors_lazy(data_path, start_date=start_date, end_date=end_date, codes=codes)
+    scored_data = process_cross_section(raw_factors)
+    return build_nav_lazy(build_selection_lazy(scored_data, top_n=top_n))
+
+
+def summarize_nav(nav_df: pl.DataFrame) -> dict:
+    """对已收集的净值表算汇总指标（行数 = 交易日数，纯小表运算）。"""
+    n = nav_df.height
+    if n == 0:
+        return {'n_days': 0, 'final_nav': 1.0, 'total_return': 0.0,
+                'annual_return': 0.0, 'sharpe_ratio': 0.0, 'max_drawdown': 0.0}
+    rets = nav_df["strategy_ret"]
+    cum = nav_df["cum_nav"]
+    final_nav = float(cum[-1])
+    std = rets.std()
+    sharpe = float(rets.mean() / std * (252 ** 0.5)) if std and std > 0 else 0.0
+    max_dd = float((cum / cum.cum_max() - 1).min())
+    return {
+        'n_days': n,
+        'final_nav': final_nav,
+        'total_return': final_nav - 1,
+        'annual_return': final_nav ** (252 / n) - 1,
+        'sharpe_ratio': sharpe,
+        'max_drawdown': max_dd,
+    }
+
+
+def run_backtest(data_path="../data/stocks.parquet", top_n=30, start_date=None, end_date=None, codes=None,
+                 streaming=True) -> pl.DataFrame:
+    """
+    运行回测
+
+    参数:
+        data_path: 数据文件路径（单文件或 hive 分区目录）
+        top_n: 选股数量
+        start_date, end_date: 可选回测区间（下推进 scan，按年分区时整年剪枝）
+        codes: 可选股票代码子集
+        streaming: True 则用 Polars streaming 引擎收集，全程有界内存；
+            峰值仍偏高时可调小 POLARS_STREAMING_CHUNK_SIZE 或
+            POLARS_MAX_THREADS（见 process_cross_section 说明）
+    返回: Polars DataFrame（date / strategy_ret / stock_count / cum_nav）
+    """
+    print("构建计算图...")
+    nav_lazy = build_pipeline_lazy(
+        data_path, top_n=top_n, start_date=start_date, end_date=end_date, codes=codes)
+
+    # 此时才真正触发所有计算！扫描到净值一个计划，Rust 引擎全速运转
+    nav_df = nav_lazy.collect(streaming=streaming)
+
+    stats = summarize_nav(nav_df)
+    print("回测完成，最后净值:", stats['final_nav'])
+
+    return nav_df
 
 if __name__ == "__main__":
-    run_backtest()
\ No newline at end of file
+    run_backtest()
@@ -1,145 +1,255 @@
 import akshare as ak
 import polars as pl
+import shutil
 import time
+import threading
+from concurrent.futures import ThreadPoolExecutor, as_completed
 from tqdm import tqdm
 from pathlib import Path
 from datetime import datetime, timedelta
 
-def fetch_and_save_data(update_mode="full", start_date="20200101", end_date=None, data_path="../data/stocks.parquet"):
+
+class _TokenBucket:
+    """
+    令牌桶限速器：以 rate 个/秒补充令牌，容量 burst。
+    并发下载时保证对 akshare 端点的总请求速率不超标。
+    """
+    def __init__(self, rate: float, burst: int):
+        self.rate = rate
+        self.capacity = burst
+        self.tokens = float(burst)
+        self.last = time.monotonic()
+        self.lock = threading.Lock()
+
+    def acquire(self):
+        while True:
+            with self.lock:
+                now = time.monotonic()
+                self.tokens = min(self.capacity, self.tokens + (now - self.last) * self.rate)
+                self.last = now
+                if self.tokens >= 1.0:
+                    self.tokens -= 1.0
+                    return
+                wait = (1.0 - self.tokens) / self.rate
+            time.sleep(wait)
+
+
+def _clean_symbol_frame(df_pandas, code: str) -> pl.DataFrame:
+    """单只股票的 Pandas -> Polars 转换、改名、选列（与原循环体一致）。"""
+    df_pl = pl.from_pandas(df_pandas)
+    df_pl = df_pl.with_columns(pl.lit(code).alias("code"))
+    df_pl = df_pl.rename({
+        "日期": "date", "开盘": "open", "收盘": "close",
+        "最高": "high", "最低": "low", "成交量": "volume",
+        "换手率": "turnover"
+    })
+    df_pl = df_pl.select(["date", "code", "open", "high", "low", "close", "volume", "turnover"])
+    # 确保 date 列是字符串类型（便于后续统一处理）
+    if df_pl["date"].dtype != pl.Utf8:
+        df_pl = df_pl.with_columns(pl.col("date").cast(pl.Utf8))
+    return df_pl
+
+
+def _fetch_one(code: str, fetch_start_date: str, end_date: str, bucket: _TokenBucket,
+               max_retries: int = 3, backoff: float = 1.0):
+    """
+    拉取并清洗单只股票，带限速与指数退避重试。
+    返回 polars.DataFrame；无数据返回 None；重试耗尽抛出最后一次异常。
+    """
+    last_err = None
+    for attempt in range(max_retries):
+        bucket.acquire()
+        try:
+            df_pandas = ak.stock_zh_a_hist(symbol=code, adjust="qfq",
+                                           start_date=fetch_start_date, end_date=end_date)
+            if df_pandas.empty:
+                return None
+            return _clean_symbol_frame(df_pandas, code)
+        except Exception as e:
+            last_err = e
+            time.sleep(backoff * (2 ** attempt))
+    raise last_err
+
+
+def _scan_existing(data_path):
+    """扫描现有数据：单文件或 hive 分区目录都支持。"""
+    p = Path(data_path)
+    if p.is_dir():
+        return pl.scan_parquet(str(p / "**" / "*.parquet"), hive_partitioning=True)
+    return pl.scan_parquet(str(p))
+
+
+def fetch_and_save_data(update_mode="full", start_date="20200101", end_date=None, data_path="../data/stocks.parquet",
+                        max_workers=8, requests_per_sec=5.0, max_retries=3, staging_dir=None,
+                        partition_by_year=False):
     """
     获取并保存股票数据
-    
+
     参数:
         update_mode: "full" 全量更新 或 "incremental" 增量更新
         start_date: 起始日期，格式 "YYYYMMDD"
         end_date: 结束日期，格式 "YYYYMMDD"，None 则使用今天
         data_path: 数据保存路径
+        max_workers: 并发下载线程数（网络 IO 密集，线程即可重叠延迟）
+        requests_per_sec: 对 akshare 端点的总限速（令牌桶）
+        max_retries: 单只股票的重试次数（指数退避）
+        staging_dir: 暂存目录（默认 data_path 旁的 _staging/）。每只股票
+                     下载完立即落盘，峰值内存与股票池规模无关；中途崩溃
+                     后重跑会跳过已暂存的股票直接续传
+        partition_by_year: True 则把 data_path 当作目录，按 year=YYYY 写
+                     hive 分区数据集；下游按日期过滤时可整年剪枝
     """
     # 设置结束日期
     if end_date is None:
         end_date = datetime.now().strftime("%Y%m%d")
-    
+
+    if staging_dir is None:
+        staging_dir = Path(data_path).parent / "_staging"
+    staging_dir = Path(staging_dir)
+    staging_dir.mkdir(parents=True, exist_ok=True)
+
     # 1. 获取A股所有股票代码
     print("获取股票列表...")
     stock_info = ak.stock_zh_a_spot_em()
     # 示例：只取前50只做演示 (实盘请去掉 .head(50))
-    codes = stock_info['代码'].head(50).to_list() 
-    
-    # 增量模式：读取现有数据，获取每只股票的最新日期
-    existing_data = None
+    codes = stock_info['代码'].head(50).to_list()
+
+    # 上次分区替换若在换名间隙崩溃，完整数据会留在 .old：先恢复回来
+    old_dir = Path(str(data_path) + ".old")
+    if old_dir.exists() and not Path(data_path).exists():
+        old_dir.replace(Path(data_path))
+        print("检测到上次数据集替换中断，已从 .old 恢复")
+
+    # 增量模式：扫描现有数据（lazy，不整表读入内存），获取每只股票的最新日期
+    has_existing = False
     code_max_dates = {}
     if update_mode == "incremental":
         data_file = Path(data_path)
         if data_file.exists():
-            print("读取现有数据...")
+            print("读取现有数据的日期范围...")
             try:
-                existing_data = pl.read_parquet(data_path)
-                # 获取每只股票的最新日期
                 code_max_dates = (
-                    existing_data
+                    _scan_existing(data_path)
                     .group_by("code")
                     .agg(pl.col("date").max().alias("max_date"))
+                    .collect()
                     .to_dict(as_series=False)
                 )
                 code_max_dates = dict(zip(code_max_dates["code"], code_max_dates["max_date"]))
+                has_existing = True
                 print(f"找到 {len(code_max_dates)} 只股票的历史数据")
             except Exception as e:
                 print(f"读取现有数据失败: {e}，将执行全量更新")
                 update_mode = "full"
     
-    data_list = []
-    
-    # 2. 循环下载 (网络IO是瓶颈，Polars在这里帮不上忙，只能等)
-    print(f"开始下载 {len(codes)} 只股票数据...")
-    for code in tqdm(codes):
-        try:
-            # 增量模式：计算该股票的起始日期
-            fetch_start_date = start_date
-            if update_mode == "incremental" and code in code_max_dates:
-                # 获取该股票最新日期的下一天
-                max_date = code_max_dates[code]
-                next_date = max_date + timedelta(days=1)
-                fetch_start_date = next_date.strftime("%Y%m%d")
-                # 如果最新日期已经等于或晚于结束日期，跳过
-                end_date_obj = datetime.strptime(end_date, "%Y%m%d").date()
-                if max_date >= end_date_obj:
-                    continue
-            
-            # AkShare 返回的是 Pandas DF，需要转换
-            # qfq: 前复权
-            df_pandas = ak.stock_zh_a_hist(symbol=code, adjust="qfq", start_date=fetch_start_date, end_date=end_date)
-            
-            if df_pandas.empty:
-                continue
-
-            # Pandas -> Polars (零拷贝转换如果可能的话，但这里会有拷贝)
-            df_pl = pl.from_pandas(df_pandas)
-            
-            # 添加股票代码列 (这是长表的关键 Key)
-            df_pl = df_pl.with_columns(pl.lit(code).alias("code"))
-            
-            # 简单改名方便后续引用
-            df_pl = df_pl.rename({
-                "日期": "date", "开盘": "open", "收盘": "close", 
-                "最高": "high", "最低": "low", "成交量": "volume",
-                "换手率": "turnover"
-            })
-            
-            # 选需要的列，并确保 date 列是字符串类型（便于后续统一处理）
-            df_pl = df_pl.select(["date", "code", "open", "high", "low", "close", "volume", "turnover"])
-            # 确保 date 列是字符串类型
-            if df_pl["date"].dtype == pl.Date:
-                df_pl = df_pl.with_columns(pl.col("date").cast(pl.Utf8))
-            elif df_pl["date"].dtype != pl.Utf8:
-                df_pl = df_pl.with_columns(pl.col("date").cast(pl.Utf8))
-            data_list.append(df_pl)
-            
-        except Exception as e:
-            print(f"Error fetching {code}: {e}")
+    # 2. 计算每只股票的实际拉取区间（增量模式跳过已是最新的；
+    #    已暂存的股票视为完成，崩溃重跑从断点续传）
+    end_date_obj = datetime.strptime(end_date, "%Y%m%d").date()
+    staged_codes = {p.stem for p in staging_dir.glob("*.parquet")}
+    if staged_codes:
+        print(f"暂存区已有 {len(staged_codes)} 只股票，续传剩余部分...")
+    fetch_plan = []  # (code, fetch_start_date)
+    for code in codes:
+        if code in staged_codes:
             continue
+        fetch_start_date = start_date
+        if update_mode == "incremental" and code in code_max_dates:
+            max_date = code_max_dates[code]
+            if max_date >= end_date_obj:
+                continue  # 已是最新，跳过
+            fetch_start_date = (max_date + timedelta(days=1)).strftime("%Y%m%d")
+        fetch_plan.append((code, fetch_start_date))
+
+    # 3. 并发下载，每只股票一到即写入暂存 Parquet（内存里不留全量列表）
+    failed = []
+    staged_count = len(staged_codes)
+    bucket = _TokenBucket(rate=requests_per_sec, burst=max(1, int(requests_per_sec)))
+    print(f"开始下载 {len(fetch_plan)} 只股票数据（{max_workers} 并发, {requests_per_sec}/s 限速）...")
+    with ThreadPoolExecutor(max_workers=max_workers) as pool:
+        futures = {
+            pool.submit(_fetch_one, code, fs, end_date, bucket, max_retries): code
+            for code, fs in fetch_plan
+        }
+        for future in tqdm(as_completed(futures), total=len(futures)):
+            code = futures[future]
+            try:
+                df_pl = future.result()
+                if df_pl is not None:
+                    df_pl.write_parquet(staging_dir / f"{code}.parquet")
+                    staged_count += 1
+            except Exception as e:
+                failed.append((code, str(e)))
+
+    if failed:
+        print(f"下载失败 {len(failed)} 只（已重试 {max_retries} 次）:")
+        for code, err in failed:
+            print(f"  {code}: {err}")
 
-    # 3. 合并与清洗 (Polars 的强项)
-    if not data_list:
-        if update_mode == "incremental" and existing_data is not None:
+    # 4. 出核合并：lazy 扫描暂存区（+现有数据），去重排序后一次落盘
+    if staged_count == 0:
+        if update_mode == "incremental" and has_existing:
             print("无新数据，保持现有数据不变")
             return
         print("无数据下载")
         return
 
     print("正在合并与清洗...")
-    # Lazy Evaluation 模式
-    df_all = pl.concat(data_list)
-    
-    # 数据类型转换与清洗 Pipeline
-    # 此时所有 date 列都应该是字符串类型，统一转换为日期
-    df_clean = (
-        df_all.lazy()
+    # 暂存帧的 date 都是字符串，统一转日期并压缩数值类型
+    staged_lazy = (
+        pl.scan_parquet(str(staging_dir / "*.parquet"))
         .with_columns([
-            # 日期处理：字符串转日期（AkShare 返回格式通常是 "YYYY-MM-DD"）
             pl.col("date").str.strptime(pl.Date, "%Y-%m-%d", strict=False).alias("date"),
             pl.col("close").cast(pl.Float32),       # 32位浮点够用了，省一半内存
             pl.col("volume").cast(pl.Float32),
             pl.col("turnover").cast(pl.Float32)
         ])
-        .sort(["code", "date"]) # 必须排序，为了后续计算 rolling
-    ).collect() # 执行
-    
-    # 增量模式：合并新旧数据并去重
-    if update_mode == "incremental" and existing_data is not None:
-        print("合并新旧数据...")
-        df_combined = pl.concat([existing_data, df_clean])
-        # 按 (code, date) 去重，保留最后一条（新数据优先）
-        df_clean = (
-            df_combined
-            .sort(["code", "date", "close"], descending=[False, False, True])
-            .unique(subset=["code", "date"], keep="first")
-            .sort(["code", "date"])
-        )
-    
-    # 4. 存为 Parquet (极速读写)
-    # 确保目录存在
+    )
+
+    if update_mode == "incremental" and has_existing:
+        # 与现有数据合并：按 (code, date) 去重，close 降序保证新数据优先
+        existing_lazy = _scan_existing(data_path)
+        if partition_by_year:
+            existing_lazy = existing_lazy.drop("year", strict=False)
+        merged = pl.concat([existing_lazy, staged_lazy], how="diagonal")
+    else:
+        merged = staged_lazy
+
+    df_clean = (
+        merged
+        .sort(["code", "date", "close"], descending=[False, False, True])
+        .unique(subset=["code", "date"], keep="first")
+        .sort(["code", "date"])  # 必须排序，为了后续计算 rolling
+        .collect(streaming=True)
+    )
+
+    # 5. 原子替换目标文件/数据集，成功后清空暂存区
     Path(data_path).parent.mkdir(parents=True, exist_ok=True)
-    df_clean.write_parquet(data_path)
+    if partition_by_year:
+        # 按年 hive 分区写出：year=YYYY 子目录 + row-group 统计，
+        # 下游日期过滤可在 scan 阶段整年剪枝
+        tmp_dir = Path(str(data_path) + ".tmp")
+        if tmp_dir.exists():
+            shutil.rmtree(tmp_dir)
+        (
+            df_clean
+            .with_columns(pl.col("date").dt.year().alias("year"))
+            .write_parquet(tmp_dir, partition_by=["year"])
+        )
+        # 旧数据先挪到 .old 而不是直接删：任一时刻磁盘上都有完整数据集，
+        # 崩溃后下次运行从 .old 恢复（见函数开头），不会退化成全量重拉
+        if old_dir.exists():
+            shutil.rmtree(old_dir)
+        if Path(data_path).exists():
+            Path(data_path).replace(old_dir)
+        tmp_dir.replace(data_path)
+        if old_dir.exists():
+            shutil.rmtree(old_dir)
+    else:
+        tmp_path = Path(str(data_path) + ".tmp")
+        df_clean.write_parquet(tmp_path)
+        tmp_path.replace(data_path)
+    for p in staging_dir.glob("*.parquet"):
+        p.unlink()
     print(f"数据入库完成，共 {df_clean.height} 行")
 
 if __name__ == "__main__":
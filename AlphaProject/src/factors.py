@@ -1,18 +1,16 @@
+from datetime import date, datetime, timedelta
+from pathlib import Path
+
 import polars as pl
 
-def compute_factors_lazy(data_path="../data/stocks.parquet"):
-    """
-    计算因子（Lazy模式）
-    
-    参数:
-        data_path: 数据文件路径
-    """
-    # 使用 scan_parquet 开启 Lazy 模式 (不一次性读入内存，构建计算图)
-    # 这对于几千只股票的数据处理至关重要
-    q = pl.scan_parquet(data_path)
+# 最大滚动窗口：决定增量计算需要回看的尾部上下文长度
+# （20 日波动率是目前最长的窗口；新增更长窗口的因子时同步更新）
+MAX_FACTOR_WINDOW = 20
 
-    # 定义因子计算表达式
-    factors = q.with_columns([
+
+def _factor_exprs():
+    """因子表达式清单：全量与增量两条路径共用同一套定义。"""
+    return [
         # 1. 收益率 (Label)：下期收益率 (Shift -1)
         # 这里的 over('code') 保证了 shift 是在每只股票内部进行的
         pl.col("close").pct_change().shift(-1).over("code").alias("next_ret"),
@@ -26,50 +24,214 @@ def compute_factors_lazy(data_path="../data/stocks.parquet"):
         # 4. 因子：量比 (复杂 Rolling 计算)
         # rolling_mean 需要先按时间排序，AkShare数据下载时若已排序则不需要重排
         (
-            pl.col("volume") / 
+            pl.col("volume") /
             pl.col("volume").rolling_mean(window_size=5).over("code")
         ).alias("factor_vol_ratio"),
-        
+
         # 5. 因子：波动率 (过去20天收盘价标准差)
         pl.col("close").rolling_std(window_size=20).over("code").alias("factor_volatility")
-    ])
+    ]
+
+
+def _parse_date(d):
+    """接受 'YYYYMMDD' / 'YYYY-MM-DD' / date，统一转成 date。"""
+    if d is None or isinstance(d, date):
+        return d
+    s = str(d).replace("-", "")
+    return datetime.strptime(s, "%Y%m%d").date()
+
+
+def scan_stock_dataset(data_path, start_date=None, end_date=None, codes=None):
+    """
+    统一扫描入口：data_path 可以是单个 Parquet 文件，也可以是
+    fetch_and_save_data(partition_by_year=True) 写出的 hive 分区目录。
+    日期/代码过滤在 scan 上直接下推：分区目录按 year=... 整段剪枝，
+    单文件靠 row-group 统计信息跳页。只回测 2024 不用读 2020-2023。
+    """
+    p = Path(data_path)
+    is_dataset = p.is_dir()
+    if is_dataset:
+        lf = pl.scan_parquet(str(p / "**" / "*.parquet"), hive_partitioning=True)
+    else:
+        lf = pl.scan_parquet(str(p))
+
+    start = _parse_date(start_date)
+    end = _parse_date(end_date)
+    if start is not None:
+        lf = lf.filter(pl.col("date") >= start)
+        if is_dataset:
+            lf = lf.filter(pl.col("year") >= start.year)
+    if end is not None:
+        lf = lf.filter(pl.col("date") <= end)
+        if is_dataset:
+            lf = lf.filter(pl.col("year") <= end.year)
+    if codes is not None:
+        lf = lf.filter(pl.col("code").is_in(list(codes)))
+    return lf
+
+
+def compute_factors_lazy(data_path="../data/stocks.parquet", start_date=None, end_date=None, codes=None):
+    """
+    计算因子（Lazy模式）
+
+    参数:
+        data_path: 数据文件路径（单文件或 hive 分区目录）
+        start_date, end_date: 可选日期过滤（下推进 scan 剪枝）；
+            为保证滚动窗口完整，扫描会自动前移一段缓冲，再裁回请求区间
+        codes: 可选股票代码子集
+    """
+    # 使用 scan_parquet 开启 Lazy 模式 (不一次性读入内存，构建计算图)
+    # 这对于几千只股票的数据处理至关重要
+    start = _parse_date(start_date)
+    # 滚动窗口上下文缓冲：20 个交易日约等于 40 个自然日
+    buffered_start = start - timedelta(days=MAX_FACTOR_WINDOW * 2) if start else None
+    q = scan_stock_dataset(data_path, start_date=buffered_start, end_date=end_date, codes=codes)
+
+    # 定义因子计算表达式
+    factors = q.with_columns(_factor_exprs())
 
     # 过滤掉计算产生的 Null (比如前5天没有MA)
     factors = factors.filter(pl.col("factor_vol_ratio").is_not_null())
 
+    # 裁回请求区间（缓冲行只为滚动窗口服务）
+    if start is not None:
+        factors = factors.filter(pl.col("date") >= start)
+
     return factors  # 返回的是 LazyFrame，还没计算
 
-def process_cross_section(lf: pl.LazyFrame):
-    # 定义去极值表达式 (Clip at 1% and 99% quantile)
-    # 注意：这里是在 "date" 维度上 over，即每天处理所有股票
-    def winsorize(col_name):
-        return (
-            pl.col(col_name)
-            .clip(
-                min_val=pl.col(col_name).quantile(0.01).over("date"),
-                max_val=pl.col(col_name).quantile(0.99).over("date")
-            )
-        )
-    
-    # 定义标准化表达式 (Z-Score)
-    def standardize(col_name):
-        return (
-            (pl.col(col_name) - pl.col(col_name).mean().over("date")) /
-            (pl.col(col_name).std().over("date") + 1e-6) # 防止除零
+
+def compute_factors_incremental(data_path="../data/stocks.parquet", store_path=None):
+    """
+    增量因子计算：只为新增的 (code, date) 算因子，追加进持久因子库。
+
+    - 因子库不存在时退化为全量计算并落盘
+    - 否则按 code 找出库内最后日期，仅加载其前 MAX_FACTOR_WINDOW 根 K 线
+      作为滚动窗口上下文；最后日期当天也会重算（其 next_ret 依赖次日数据）
+    - 日常任务的开销与更新量成正比，而不是与全部历史成正比
+
+    返回: 指向更新后因子库的 LazyFrame（可直接接 process_cross_section）。
+    """
+    if store_path is None:
+        store_path = Path(data_path).parent / "factors.parquet"
+    store_path = Path(store_path)
+
+    if not store_path.exists():
+        print("因子库不存在，执行全量计算...")
+        full = compute_factors_lazy(data_path).collect(streaming=True)
+        store_path.parent.mkdir(parents=True, exist_ok=True)
+        full.write_parquet(store_path)
+        return pl.scan_parquet(store_path)
+
+    # 每只股票在库内的最后日期；库里没有的新股票 last_date 置为极早值
+    last_dates = (
+        pl.scan_parquet(store_path)
+        .group_by("code")
+        .agg(pl.col("date").max().alias("last_date"))
+    )
+
+    subset = (
+        scan_stock_dataset(data_path)
+        .join(last_dates, on="code", how="left")
+        .with_columns(pl.col("last_date").fill_null(pl.lit(date(1900, 1, 1))))
+        .sort(["code", "date"])
+        .with_columns([
+            pl.int_range(pl.len()).over("code").alias("_idx"),
+            (pl.col("date") < pl.col("last_date")).sum().over("code").alias("_n_old"),
+        ])
+        # 仅保留新行及其前 MAX_FACTOR_WINDOW 根上下文
+        .filter(pl.col("_idx") >= pl.col("_n_old") - MAX_FACTOR_WINDOW)
+        .with_columns(_factor_exprs())
+        # 上下文行只为滚动窗口服务，算完即丢；最后日期当天重算
+        .filter(pl.col("date") >= pl.col("last_date"))
+        .filter(pl.col("factor_vol_ratio").is_not_null())
+        .drop(["_idx", "_n_old", "last_date"])
+        .collect(streaming=True)
+    )
+
+    if subset.is_empty():
+        print("因子库已是最新")
+        return pl.scan_parquet(store_path)
+
+    # 库内 >= last_date 的行被重算版本替换，其余原样保留
+    kept = (
+        pl.scan_parquet(store_path)
+        .join(last_dates, on="code", how="left")
+        .filter(pl.col("date") < pl.col("last_date"))
+        .drop("last_date")
+        .collect(streaming=True)
+    )
+
+    updated = pl.concat([kept, subset], how="diagonal").sort(["code", "date"])
+    tmp_path = store_path.with_suffix(".parquet.tmp")
+    updated.write_parquet(tmp_path)
+    tmp_path.replace(store_path)
+    print(f"因子库已更新：新增/重算 {subset.height} 行，总计 {updated.height} 行")
+    return pl.scan_parquet(store_path)
+
+def process_cross_section(lf: pl.LazyFrame, winsorize: bool = True, approx_quantile: bool = False):
+    """
+    横截面处理（去极值 + 标准化 + 因子合成），单遍融合核。
+
+    所有因子列的每日统计量（1%/99% 分位、去极值后的均值与标准差）在
+    同一次 group_by("date") 聚合里算完——因子数量翻倍不再增加分组遍数。
+    join 回明细后 clip 与 Z-Score 一步应用；均值/标准差基于去极值后的
+    值计算，口径与"先 winsorize 再 standardize"一致。
+    该结构同样保持 streaming 可执行（见 run_backtest 的内存旋钮说明）。
+
+    参数:
+        winsorize: 是否在标准化前按 1%/99% 分位去极值
+        approx_quantile: True 用 nearest 插值取分位（宽截面上更省），
+            False 用默认线性插值
+    """
+    factor_cols = ["factor_vol_ratio", "factor_turnover"]
+    interp = "nearest" if approx_quantile else "linear"
+
+    # 每日横截面统计量：全部因子一次分组聚合
+    aggs = []
+    for c in factor_cols:
+        if winsorize:
+            q01 = pl.col(c).quantile(0.01, interpolation=interp)
+            q99 = pl.col(c).quantile(0.99, interpolation=interp)
+            clipped = pl.col(c).clip(q01, q99)
+            aggs += [
+                q01.alias(f"_{c}_q01"),
+                q99.alias(f"_{c}_q99"),
+                clipped.mean().alias(f"_{c}_mean"),
+                clipped.std().alias(f"_{c}_std"),
+            ]
+        else:
+            aggs += [
+                pl.col(c).mean().alias(f"_{c}_mean"),
+                pl.col(c).std().alias(f"_{c}_std"),
+            ]
+    stats = lf.group_by("date").agg(aggs)
+
+    # join 回明细：clip + Z-Score 一步完成（防止除零）
+    z_exprs = []
+    helper_cols = []
+    for c in factor_cols:
+        value = pl.col(c)
+        if winsorize:
+            value = value.clip(pl.col(f"_{c}_q01"), pl.col(f"_{c}_q99"))
+            helper_cols += [f"_{c}_q01", f"_{c}_q99"]
+        z_exprs.append(
+            ((value - pl.col(f"_{c}_mean")) / (pl.col(f"_{c}_std") + 1e-6))
+            .alias(f"z_{c.removeprefix('factor_')}")
         )
+        helper_cols += [f"_{c}_mean", f"_{c}_std"]
 
-    # 应用处理
-    # 假设我们合成一个 simple_score = 0.5*量比 + 0.5*换手率 (追热点策略)
-    processed = lf.with_columns([
-        standardize("factor_vol_ratio").alias("z_vol_ratio"),
-        standardize("factor_turnover").alias("z_turnover")
-    ])
+    processed = (
+        lf.join(stats, on="date", how="left")
+        .with_columns(z_exprs)
+        .drop(helper_cols)
+    )
 
     # 因子合成
+    # 假设我们合成一个 simple_score = 0.5*量比 + 0.5*换手率 (追热点策略)
     final_score = processed.with_columns(
         (pl.col("z_vol_ratio") * 0.5 + pl.col("z_turnover") * 0.5).alias("score")
     )
-    
+
     return final_score
 
 if __name__ == "__main__":
@@ -1,4 +1,6 @@
-from .engine import run_backtest, load_bt_data
-from .batch import run_ma_grid_batch
+from .engine import run_backtest, load_bt_data, EvalService
+from .batch import run_ma_grid_batch, grid_completeness_report
+from .result_store import ResultStore, merge_stores
+from .results_db import ResultsDB
 
 
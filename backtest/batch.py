@@ -1,9 +1,139 @@
+import math
 import os
+import zlib
+from concurrent.futures import ProcessPoolExecutor, as_completed
 import pandas as pd
 from typing import List, Sequence, Tuple, Dict, Any
 
 from strategies import DualMovingAverageStrategy
 from backtest import run_backtest
+from backtest.result_store import ResultStore
+
+
+def shard_of(symbol: str, shard_count: int) -> int:
+    """标的到分片的确定性映射（crc32 取模，与 symbols 文件顺序无关）。"""
+    return zlib.crc32(str(symbol).encode('utf-8')) % shard_count
+
+
+def _run_grid_cell(
+    sym: str,
+    fast: int,
+    slow: int,
+    start_date: str,
+    end_date: str,
+    initial_cash: float,
+    commission: float,
+    cheat_on_close: bool,
+    engine: str,
+) -> Dict[str, Any]:
+    """
+    执行网格中一个 (symbol, fast, slow) 单元并返回记录 dict。
+    模块级函数以便被 ProcessPoolExecutor 序列化；每个 worker 进程
+    在首次导入时各自建立 Mongo 连接并复用。
+    """
+    result = run_backtest(
+        symbols=sym,
+        start_date=start_date,
+        end_date=end_date,
+        strategy_cls=DualMovingAverageStrategy,
+        strategy_params=dict(fast=fast, slow=slow, printlog=False),
+        initial_cash=initial_cash,
+        commission=commission,
+        cheat_on_close=cheat_on_close,
+        add_analyzers=True,
+        verbose=False,
+        engine=engine,
+    )
+    analyzers = result.get('analyzers', {})
+    sharpe = analyzers.get('sharpe', {}).get('sharperatio')
+    dd = analyzers.get('drawdown', {})
+    max_dd_pct = dd.get('max', {}).get('drawdown')
+    max_dd_money = dd.get('max', {}).get('moneydown')
+    rets = analyzers.get('returns', {})
+    rtot = rets.get('rtot')
+    rnorm100 = rets.get('rnorm100')
+    trades = analyzers.get('trades', {})
+    total_trades = trades.get('total', {}).get('total', 0)
+    won_trades = trades.get('won', {}).get('total', 0)
+    win_rate = (won_trades / total_trades * 100.0) if total_trades else 0.0
+
+    return dict(
+        symbol=sym,
+        strategy=DualMovingAverageStrategy.__name__,
+        fast=fast,
+        slow=slow,
+        start_date=start_date,
+        end_date=end_date,
+        final_value=result.get('final_value'),
+        sharpe=sharpe,
+        max_dd_pct=max_dd_pct,
+        max_dd_money=max_dd_money,
+        rtot=rtot,
+        rnorm100=rnorm100,
+        total_trades=total_trades,
+        win_rate=win_rate,
+    )
+
+
+def _run_halving_for_symbol(
+    sym: str,
+    combos: Sequence[Tuple[int, int]],
+    start_date: str,
+    end_date: str,
+    initial_cash: float,
+    commission: float,
+    cheat_on_close: bool,
+    engine: str,
+    keep_fraction: float = 0.5,
+    n_rungs: int = 3,
+    metric: str = 'sharpe',
+) -> List[Dict[str, Any]]:
+    """
+    对单只股票执行逐次减半（successive halving）参数搜索：
+    - 第 1 轮在较短的起始切片上评估全部组合
+    - 每轮按 metric 保留前 keep_fraction，窗口翻倍，最后一轮跑满全区间
+    - 被剪枝的组合保留其最后一轮的记录并标 pruned=1；幸存组合 pruned=0
+    明显劣质的组合不再为整个区间买单，总 bar 评估量约降 3-5 倍。
+    """
+    start = pd.to_datetime(start_date)
+    end = pd.to_datetime(end_date)
+    total_days = max((end - start).days, 1)
+
+    records: List[Dict[str, Any]] = []
+    survivors = list(combos)
+    for rung in range(n_rungs):
+        if rung == n_rungs - 1:
+            rung_end_str = end_date
+        else:
+            frac = 1.0 / (2 ** (n_rungs - 1 - rung))
+            rung_end = start + pd.Timedelta(days=int(total_days * frac))
+            rung_end_str = rung_end.strftime('%Y%m%d')
+
+        rung_records = []
+        for fast, slow in survivors:
+            rec = _run_grid_cell(
+                sym, fast, slow, start_date, rung_end_str,
+                initial_cash, commission, cheat_on_close, engine,
+            )
+            rec['pruned'] = 0
+            rung_records.append(rec)
+
+        if rung == n_rungs - 1:
+            records.extend(rung_records)
+            break
+
+        # metric 为 None 的排最后（无交易/样本不足时 sharpe 可能缺失）
+        rung_records.sort(
+            key=lambda r: (r.get(metric) is not None, r.get(metric)),
+            reverse=True,
+        )
+        keep = max(1, math.ceil(len(rung_records) * keep_fraction))
+        for rec in rung_records[keep:]:
+            rec['pruned'] = 1
+            records.append(rec)
+        survivors = [(rec['fast'], rec['slow']) for rec in rung_records[:keep]]
+
+    return records
 
 
 def run_ma_grid_batch(
@@ -17,10 +147,31 @@ def run_ma_grid_batch(
     commission: float = 0.001,
     cheat_on_close: bool = True,
     out_csv: str = 'ma_grid_results.csv',
+    engine: str = 'backtrader',
+    n_workers: int = 1,
+    store_dir: str = None,
+    search: str = 'grid',
+    halving_keep_fraction: float = 0.5,
+    halving_rungs: int = 3,
+    shard_index: int = 0,
+    shard_count: int = 1,
 ) -> pd.DataFrame:
     """
     批量执行双均线参数网格回测：从 symbols.csv 读取标的，按 mode 选择批次，结果写入 CSV。
     mode='pending' 仅回测未标记；mode='all' 全量回测。
+    engine 透传给 run_backtest（'backtrader' 或 'vectorized'）。
+    n_workers>1 时用进程池并行执行各 (symbol, fast, slow) 单元，
+    结果按完成顺序合并；一只股票的全部单元完成后才标记 tested=1。
+    store_dir 非空时每个完成单元原子写入增量结果库（ResultStore），
+    崩溃重跑自动跳过已完成单元；symbols.csv 的 tested 标记改为批次
+    结束时一次性写回，不再每只股票重写整个文件。
+    search='halving' 用逐次减半搜索代替穷举：短窗口先筛一轮，按
+    halving_keep_fraction 保留幸存者并翻倍窗口，共 halving_rungs 轮；
+    输出多一列"剪枝"标记被提前淘汰的组合（其记录对应较短区间）。
+    集群模式：shard_count>1 时本机只跑 shard_of(symbol) == shard_index
+    的标的（crc32 确定性映射，各机拿同一份 symbols 文件即可不重不漏），
+    tested/last_run 状态随结果一起记在各自的结果库里（需要 store_dir），
+    跑完用 merge_stores 合并各分片、grid_completeness_report 核对完整性。
     返回中文列 DataFrame（已排序、两位小数未四舍五入，建议外部打印时 round(2)）。
     """
     # 读取/初始化 symbol 文件
@@ -33,69 +184,187 @@ def run_ma_grid_batch(
         sym_df = pd.DataFrame({'symbol': [], 'tested': []})
         sym_df.to_csv(symbols_file, index=False, encoding='utf-8-sig')
 
+    store = ResultStore(store_dir) if store_dir else None
+    if shard_count > 1 and store is None:
+        raise ValueError('分片模式需要 store_dir（tested 状态记在结果库里）')
+
+    all_symbols = sym_df['symbol'].astype(str).tolist()
     if mode == 'all':
-        batch_symbols = sym_df['symbol'].astype(str).tolist()
+        batch_symbols = all_symbols
+    elif store is not None:
+        # tested 状态以结果库为准，多机分片不再争抢 symbols.csv
+        tested_map = store.tested_symbols()
+        batch_symbols = [s for s in all_symbols if s not in tested_map]
     else:
-        batch_symbols = [s for s, t in zip(sym_df['symbol'].astype(str), sym_df['tested']) if int(t) != 1]
+        batch_symbols = [s for s, t in zip(all_symbols, sym_df['tested']) if int(t) != 1]
+
+    if shard_count > 1:
+        batch_symbols = [s for s in batch_symbols if shard_of(s, shard_count) == shard_index]
+        print(f"分片 {shard_index}/{shard_count}：本机负责 {len(batch_symbols)} 个标的")
 
     if not batch_symbols:
         print('无待回测标的（symbols.csv 可追加新股票）。')
         return pd.DataFrame()
 
-    records: List[Dict[str, Any]] = []
+    # 枚举所有有效网格单元（跳过 fast >= slow）
+    all_cells: List[Tuple[str, int, int]] = [
+        (sym, fast, slow)
+        for sym in batch_symbols
+        for fast in fast_list
+        for slow in slow_list
+        if fast < slow
+    ]
+
     strategy_name = DualMovingAverageStrategy.__name__
-    for sym in batch_symbols:
-        for fast in fast_list:
-            for slow in slow_list:
-                if fast >= slow:
-                    continue
-                result = run_backtest(
-                    symbols=sym,
-                    start_date=start_date,
-                    end_date=end_date,
-                    strategy_cls=DualMovingAverageStrategy,
-                    strategy_params=dict(fast=fast, slow=slow, printlog=False),
-                    initial_cash=initial_cash,
-                    commission=commission,
-                    cheat_on_close=cheat_on_close,
-                    add_analyzers=True,
-                    verbose=False,
-                )
-                analyzers = result.get('analyzers', {})
-                sharpe = analyzers.get('sharpe', {}).get('sharperatio')
-                dd = analyzers.get('drawdown', {})
-                max_dd_pct = dd.get('max', {}).get('drawdown')
-                max_dd_money = dd.get('max', {}).get('moneydown')
-                rets = analyzers.get('returns', {})
-                rtot = rets.get('rtot')
-                rnorm100 = rets.get('rnorm100')
-                trades = analyzers.get('trades', {})
-                total_trades = trades.get('total', {}).get('total', 0)
-                won_trades = trades.get('won', {}).get('total', 0)
-                win_rate = (won_trades / total_trades * 100.0) if total_trades else 0.0
-
-                records.append(dict(
-                    symbol=sym,
-                    strategy=strategy_name,
-                    fast=fast,
-                    slow=slow,
-                    start_date=start_date,
-                    end_date=end_date,
-                    final_value=result.get('final_value'),
-                    sharpe=sharpe,
-                    max_dd_pct=max_dd_pct,
-                    max_dd_money=max_dd_money,
-                    rtot=rtot,
-                    rnorm100=rnorm100,
-                    total_trades=total_trades,
-                    win_rate=win_rate,
+
+    if search == 'halving':
+        return _run_batch_halving(
+            sym_df, symbols_file, batch_symbols, start_date, end_date,
+            fast_list, slow_list, initial_cash, commission, cheat_on_close,
+            out_csv, mode, engine, n_workers, store,
+            halving_keep_fraction, halving_rungs,
+        )
+    if search != 'grid':
+        raise ValueError(f"unsupported search: {search}")
+
+    if store is not None:
+        done = store.completed()
+        cells = [
+            (sym, fast, slow) for sym, fast, slow in all_cells
+            if ResultStore.cell_key(sym, strategy_name, fast, slow, start_date, end_date) not in done
+        ]
+        if len(cells) < len(all_cells):
+            print(f"结果库已有 {len(all_cells) - len(cells)} 个单元，跳过。")
+    else:
+        cells = all_cells
+
+    # tested 标记先记在内存，批次结束时一次性写回 symbols.csv
+    remaining = {sym: 0 for sym, _, _ in all_cells}
+    for sym, _, _ in cells:
+        remaining[sym] += 1
+    tested_syms = [sym for sym, n in remaining.items() if n == 0]  # 全部单元已在库中
+    records: List[Dict[str, Any]] = []
+
+    def _on_record(record: Dict[str, Any]) -> None:
+        if store is not None:
+            store.add(record)
+        records.append(record)
+        sym = record['symbol']
+        remaining[sym] -= 1
+        if remaining[sym] == 0:
+            tested_syms.append(sym)
+
+    try:
+        if n_workers <= 1:
+            for sym, fast, slow in cells:
+                _on_record(_run_grid_cell(
+                    sym, fast, slow, start_date, end_date,
+                    initial_cash, commission, cheat_on_close, engine,
                 ))
+        else:
+            # 并行路径：单元乱序完成，按股票剩余单元计数决定何时标记 tested
+            with ProcessPoolExecutor(max_workers=n_workers) as pool:
+                futures = {
+                    pool.submit(
+                        _run_grid_cell, sym, fast, slow, start_date, end_date,
+                        initial_cash, commission, cheat_on_close, engine,
+                    ): sym
+                    for sym, fast, slow in cells
+                }
+                for future in as_completed(futures):
+                    sym = futures[future]
+                    try:
+                        _on_record(future.result())
+                    except Exception as e:
+                        print(f"网格单元执行失败 {sym}: {e}")
+    finally:
+        # 一次性批量写回 tested 标记（失败/中断也保留已完成进度）
+        _write_tested_state(store, sym_df, symbols_file, tested_syms)
 
-        # 标记该股票已完成回测
-        sym_df.loc[sym_df['symbol'] == sym, 'tested'] = 1
-        sym_df.loc[sym_df['symbol'] == sym, 'last_run'] = pd.Timestamp.now()
-        sym_df.to_csv(symbols_file, index=False, encoding='utf-8-sig')
+    return _format_and_write(records, initial_cash, mode, out_csv)
+
+
+def _write_tested_state(store, sym_df, symbols_file, tested_syms) -> None:
+    """
+    批次收尾写回 tested/last_run：有结果库时状态进库（每标的一个状态
+    文件，多机分片互不干扰）；无库时保持写回 symbols.csv 的旧行为。
+    """
+    if not tested_syms:
+        return
+    now = pd.Timestamp.now()
+    if store is not None:
+        for sym in tested_syms:
+            store.mark_tested(sym, now)
+        return
+    mask = sym_df['symbol'].astype(str).isin(tested_syms)
+    sym_df.loc[mask, 'tested'] = 1
+    sym_df.loc[mask, 'last_run'] = now
+    sym_df.to_csv(symbols_file, index=False, encoding='utf-8-sig')
+
+
+def _run_batch_halving(
+    sym_df: pd.DataFrame,
+    symbols_file: str,
+    batch_symbols: List[str],
+    start_date: str,
+    end_date: str,
+    fast_list: Sequence[int],
+    slow_list: Sequence[int],
+    initial_cash: float,
+    commission: float,
+    cheat_on_close: bool,
+    out_csv: str,
+    mode: str,
+    engine: str,
+    n_workers: int,
+    store,
+    keep_fraction: float,
+    n_rungs: int,
+) -> pd.DataFrame:
+    """halving 搜索的批量执行：按股票分发（每只股票内部逐轮淘汰）。"""
+    combos = [(f, s) for f in fast_list for s in slow_list if f < s]
+    records: List[Dict[str, Any]] = []
+    tested_syms: List[str] = []
 
+    def _finish_symbol(sym: str, recs: List[Dict[str, Any]]) -> None:
+        for rec in recs:
+            if store is not None:
+                store.add(rec)
+            records.append(rec)
+        tested_syms.append(sym)
+
+    try:
+        if n_workers <= 1:
+            for sym in batch_symbols:
+                _finish_symbol(sym, _run_halving_for_symbol(
+                    sym, combos, start_date, end_date,
+                    initial_cash, commission, cheat_on_close, engine,
+                    keep_fraction, n_rungs,
+                ))
+        else:
+            with ProcessPoolExecutor(max_workers=n_workers) as pool:
+                futures = {
+                    pool.submit(
+                        _run_halving_for_symbol, sym, combos, start_date, end_date,
+                        initial_cash, commission, cheat_on_close, engine,
+                        keep_fraction, n_rungs,
+                    ): sym
+                    for sym in batch_symbols
+                }
+                for future in as_completed(futures):
+                    sym = futures[future]
+                    try:
+                        _finish_symbol(sym, future.result())
+                    except Exception as e:
+                        print(f"halving 搜索失败 {sym}: {e}")
+    finally:
+        _write_tested_state(store, sym_df, symbols_file, tested_syms)
+
+    return _format_and_write(records, initial_cash, mode, out_csv)
+
+
+def _format_and_write(records: List[Dict[str, Any]], initial_cash: float, mode: str, out_csv: str) -> pd.DataFrame:
+    """把记录列表整理成中文列 DataFrame 并按 mode 写出 CSV。"""
     df = pd.DataFrame.from_records(records)
     if df.empty:
         return df
@@ -121,12 +390,13 @@ def run_ma_grid_batch(
         'max_dd_pct': '最大回撤(%)',
         'max_dd_money': '最大回撤金额',
         'total_trades': '交易笔数',
+        'pruned': '剪枝',
     }
     df_cn = df.rename(columns=rename_map)
     if '__cum_return' in df_cn.columns:
         df_cn = df_cn.drop(columns=['__cum_return'])
 
-    cols_order = ['标的', '策略', '开始日期', '结束日期', '短期均线', '长期均线', '期末资金', '夏普比率', '最大回撤(%)', '最大回撤金额', '累计收益(%)', '年化收益(%)', '交易笔数', '胜率(%)']
+    cols_order = ['标的', '策略', '开始日期', '结束日期', '短期均线', '长期均线', '期末资金', '夏普比率', '最大回撤(%)', '最大回撤金额', '累计收益(%)', '年化收益(%)', '交易笔数', '胜率(%)', '剪枝']
     df_cn = df_cn.reindex(columns=[c for c in cols_order if c in df_cn.columns])
 
     # 输出 CSV
@@ -139,3 +409,39 @@ def run_ma_grid_batch(
     return df_cn
 
 
+def grid_completeness_report(
+    store_dir: str,
+    symbols: Sequence[str],
+    start_date: str,
+    end_date: str,
+    fast_list: Sequence[int],
+    slow_list: Sequence[int],
+) -> Dict[str, Any]:
+    """
+    核对（通常是 merge_stores 合并后的）结果库对整个网格的覆盖情况：
+    返回 {'expected', 'done', 'missing_cells', 'missing_symbols'}，
+    missing_cells 为缺失的 (symbol, fast, slow) 列表。
+    """
+    store = ResultStore(store_dir)
+    done = store.completed()
+    strategy_name = DualMovingAverageStrategy.__name__
+    missing = [
+        (sym, fast, slow)
+        for sym in symbols
+        for fast in fast_list
+        for slow in slow_list
+        if fast < slow
+        and ResultStore.cell_key(str(sym), strategy_name, fast, slow, start_date, end_date) not in done
+    ]
+    expected = sum(1 for f in fast_list for s in slow_list if f < s) * len(symbols)
+    report = {
+        'expected': expected,
+        'done': expected - len(missing),
+        'missing_cells': missing,
+        'missing_symbols': sorted({sym for sym, _, _ in missing}),
+    }
+    print(f"网格完整性: {report['done']}/{expected} 单元完成，"
+          f"缺 {len(missing)} 个（涉及 {len(report['missing_symbols'])} 个标的）")
+    return report
+
+
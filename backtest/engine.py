@@ -1,15 +1,59 @@
 import os
 import sys
+from collections import OrderedDict
+from concurrent.futures import ProcessPoolExecutor
+from multiprocessing import shared_memory
+import numpy as np
 import pandas as pd
 import backtrader as bt
 
 # 允许从 mongo_py 导入数据函数（与项目根保持一致）
 CURRENT_DIR = os.path.dirname(os.path.dirname(__file__))
 sys.path.append(os.path.join(CURRENT_DIR, 'mongo_py'))
-from stock_data import get_stock_daily_data
+from stock_data import get_stock_daily_data, register_refresh_listener
 
+# 行情缓存：键 (symbol, start_date, end_date) -> 清洗后的 DataFrame。
+# 网格批跑对同一标的同一区间会重复加载 9 次，缓存后只查一次 Mongo。
+_FEED_CACHE: 'OrderedDict[tuple, pd.DataFrame]' = OrderedDict()
+# 数组缓存：同键 -> 连续 float32 数组 + 预转换的 bt 浮点日期，
+# 喂给 ArrayData 时零转换零拷贝
+_ARRAY_CACHE: 'OrderedDict[tuple, dict]' = OrderedDict()
+FEED_CACHE_MAX_ENTRIES = 256
+
+
+def invalidate_feed_cache(symbol: str = None) -> int:
+    """
+    失效行情缓存：指定 symbol 仅清除该标的条目，否则清空。
+    refresh_stock_data 重写某标的数据后会自动调用。返回清除条数。
+    """
+    if symbol is None:
+        n = len(_FEED_CACHE)
+        _FEED_CACHE.clear()
+        _ARRAY_CACHE.clear()
+        return n
+    keys = [k for k in _FEED_CACHE if k[0] == str(symbol)]
+    for k in keys:
+        del _FEED_CACHE[k]
+    for k in [k for k in _ARRAY_CACHE if k[0] == str(symbol)]:
+        del _ARRAY_CACHE[k]
+    return len(keys)
+
+
+# refresh/delete 重写库内数据时同步失效缓存
+register_refresh_listener(invalidate_feed_cache)
+
+
+def load_price_frame(symbol: str, start_date: str, end_date: str) -> pd.DataFrame:
+    """
+    加载并清洗单标的日线：排序、重命名、数值化、去掉无效行。
+    返回以 datetime 为索引、列为 Open/High/Low/Close/Volume 的 DataFrame。
+    同一 (symbol, start, end) 的重复加载命中进程内缓存，不再回 Mongo。
+    """
+    cache_key = (str(symbol), start_date, end_date)
+    if cache_key in _FEED_CACHE:
+        _FEED_CACHE.move_to_end(cache_key)
+        return _FEED_CACHE[cache_key]
 
-def load_bt_data(symbol: str, start_date: str, end_date: str) -> bt.feeds.PandasData:
     df = get_stock_daily_data(symbol, start_date, end_date)
     print(f"loaded rows: {len(df)}; head:\n{df.head(3)}")
     cols = ['datetime', 'open', 'high', 'low', 'close', 'volume']
@@ -27,8 +71,135 @@ def load_bt_data(symbol: str, start_date: str, end_date: str) -> bt.feeds.Pandas
     for c in ['Open', 'High', 'Low', 'Close', 'Volume']:
         df[c] = pd.to_numeric(df[c], errors='coerce')
     df = df.dropna(subset=['Open', 'High', 'Low', 'Close'])
-    data_feed = bt.feeds.PandasData(dataname=df)
-    return data_feed
+
+    # LRU 淘汰：超出上限先踢最久未用的条目
+    _FEED_CACHE[cache_key] = df
+    while len(_FEED_CACHE) > FEED_CACHE_MAX_ENTRIES:
+        _FEED_CACHE.popitem(last=False)
+    return df
+
+
+class ArrayData(bt.feed.DataBase):
+    """
+    直接以连续 numpy 数组为底的行情 feed：不建 pandas 中间对象，
+    PandasData 内部的逐列重抽取也一并省掉。datetimes 传预转换好的
+    bt 浮点日期数组（date2num 结果），_load 只做下标取值。
+    """
+    params = (
+        ('datetimes', None),
+        ('open', None),
+        ('high', None),
+        ('low', None),
+        ('close', None),
+        ('volume', None),
+    )
+
+    def start(self):
+        super().start()
+        self._idx = -1
+
+    def _load(self):
+        self._idx += 1
+        i = self._idx
+        if i >= len(self.p.datetimes):
+            return False
+        self.lines.datetime[0] = self.p.datetimes[i]
+        self.lines.open[0] = self.p.open[i]
+        self.lines.high[0] = self.p.high[i]
+        self.lines.low[0] = self.p.low[i]
+        self.lines.close[0] = self.p.close[i]
+        self.lines.volume[0] = self.p.volume[i] if self.p.volume is not None else 0.0
+        self.lines.openinterest[0] = 0.0
+        return True
+
+
+def _dates_to_btnum(index) -> np.ndarray:
+    """把 DatetimeIndex 预转换为 backtrader 浮点日期数组（整段一次）。"""
+    return np.array([bt.date2num(d) for d in index.to_pydatetime()], dtype=np.float64)
+
+
+def load_price_arrays(symbol: str, start_date: str, end_date: str) -> dict:
+    """
+    单标的行情的数组形态：各字段为连续 float32 数组，datetime 已转成
+    bt 浮点日期。结果随 _FEED_CACHE 一起缓存/失效，网格批跑 9 组参数
+    只做一次 DataFrame -> 数组的转换。
+    """
+    cache_key = (str(symbol), start_date, end_date)
+    if cache_key in _ARRAY_CACHE:
+        _ARRAY_CACHE.move_to_end(cache_key)
+        return _ARRAY_CACHE[cache_key]
+
+    df = load_price_frame(symbol, start_date, end_date)
+    arrays = {'datetimes': _dates_to_btnum(df.index)}
+    for field, col in zip(PORTFOLIO_FIELDS, ('Open', 'High', 'Low', 'Close', 'Volume')):
+        arrays[field] = np.ascontiguousarray(df[col].to_numpy(dtype=np.float32))
+
+    _ARRAY_CACHE[cache_key] = arrays
+    while len(_ARRAY_CACHE) > FEED_CACHE_MAX_ENTRIES:
+        _ARRAY_CACHE.popitem(last=False)
+    return arrays
+
+
+def load_bt_data(symbol: str, start_date: str, end_date: str) -> ArrayData:
+    arrays = load_price_arrays(symbol, start_date, end_date)
+    return ArrayData(**arrays)
+
+
+PORTFOLIO_FIELDS = ('open', 'high', 'low', 'close', 'volume')
+
+
+def load_portfolio_block(symbols, start_date: str, end_date: str) -> dict:
+    """
+    组合回测的数据装载：一次 query_many 拉取全部标的，对齐到公共交易
+    日历后放进单个 float32 数组块（fields × dates × symbols）。
+    每个标的的各字段都是该块上的零拷贝视图，避免逐标的查询与逐 feed
+    的重复 pandas 对象。停牌日价格前向填充、成交量补 0。
+    晚于 start_date 上市的标的，首个有效收盘价之前的 bar 整段裁掉
+    （ffill 只能往后填，开头的 NaN 不能喂给 broker），其 feed 从上市日
+    开始，由 backtrader 按日期对齐各 feed。
+    返回：{'dates', 'symbols', 'block', 'views', 'offsets'}，views 已含
+    裁剪后的 datetimes，可直接 ArrayData(**views[sym])。
+    """
+    from marketdata_db import MarketDataDB
+
+    db = MarketDataDB.shared()
+    df = db.query_many('daily_kline', [str(s) for s in symbols],
+                       start=start_date, end=end_date)
+    if df is None or df.empty:
+        raise ValueError(f"组合数据为空: {symbols} [{start_date}, {end_date}]")
+
+    # 逐字段透视到 (dates × symbols) 宽表，以 close 的轴为准对齐
+    close_wide = df.pivot_table(index='datetime', columns='symbol', values='close', aggfunc='last')
+    dates = close_wide.index.sort_values()
+    sym_cols = list(close_wide.columns)
+
+    block = np.empty((len(PORTFOLIO_FIELDS), len(dates), len(sym_cols)), dtype=np.float32)
+    for i, field in enumerate(PORTFOLIO_FIELDS):
+        wide = (
+            df.pivot_table(index='datetime', columns='symbol', values=field, aggfunc='last')
+            .reindex(index=dates, columns=sym_cols)
+        )
+        if field == 'volume':
+            wide = wide.fillna(0.0)
+        else:
+            wide = wide.ffill()  # 停牌日沿用前收，避免 NaN 打断指标
+        block[i] = wide.to_numpy(dtype=np.float32)
+
+    # 每标的首个有效收盘价的下标：此前的行是上市前的 NaN，直接裁掉
+    close_idx = PORTFOLIO_FIELDS.index('close')
+    dtnums = _dates_to_btnum(dates)
+    offsets = {}
+    views = {}
+    for j, sym in enumerate(sym_cols):
+        valid = np.flatnonzero(~np.isnan(block[close_idx, :, j]))
+        off = int(valid[0]) if len(valid) else len(dates)
+        if off == len(dates):
+            print(f"组合标的无有效行情，跳过: {sym}")
+        offsets[sym] = off
+        v = {field: block[i, off:, j] for i, field in enumerate(PORTFOLIO_FIELDS)}
+        v['datetimes'] = dtnums[off:]
+        views[sym] = v
+    return {'dates': dates, 'symbols': sym_cols, 'block': block, 'views': views, 'offsets': offsets}
 
 
 def run_backtest(
@@ -42,23 +213,43 @@ def run_backtest(
     cheat_on_close: bool = True,
     add_analyzers: bool = True,
     verbose: bool = True,
+    engine: str = 'backtrader',
+    portfolio: bool = False,
 ):
     """
     通用回测封装：
     - 支持单/多标的
     - 可配置策略与参数、初始资金、手续费、是否按收盘价撮合
     - 可选添加常用分析器并返回结果
+    - engine='backtrader' 逐 bar 撮合（默认，作为正确性基准）；
+      engine='vectorized' 走向量化引擎（目前仅支持双均线策略，网格批跑快几个数量级）
+    - portfolio=True 时多标的走组合装载：一次批量查询 + 共享对齐数组块，
+      百标的轮动组合的数据加载从分钟级降到单次查询
     返回：dict，包含 cerebro、results、final_value、analyzers（如启用）
     """
     strategy_params = strategy_params or {}
 
+    if engine == 'vectorized':
+        return _run_vectorized(
+            symbols, start_date, end_date, strategy_cls, strategy_params,
+            initial_cash, commission, cheat_on_close, verbose,
+        )
+    if engine != 'backtrader':
+        raise ValueError(f"unsupported engine: {engine}")
+
     cerebro = bt.Cerebro()
     cerebro.addstrategy(strategy_cls, **strategy_params)
 
     symbols_list = symbols if isinstance(symbols, (list, tuple)) else [symbols]
-    for s in symbols_list:
-        data_feed = load_bt_data(s, start_date, end_date)
-        cerebro.adddata(data_feed, name=str(s))
+    if portfolio and len(symbols_list) > 1:
+        # 组合模式：共享数组块，按标的切零拷贝视图直接喂 ArrayData
+        pf = load_portfolio_block(symbols_list, start_date, end_date)
+        for s in pf['symbols']:
+            cerebro.adddata(ArrayData(**pf['views'][s]), name=str(s))
+    else:
+        for s in symbols_list:
+            data_feed = load_bt_data(s, start_date, end_date)
+            cerebro.adddata(data_feed, name=str(s))
 
     cerebro.broker.setcash(initial_cash)
     cerebro.broker.setcommission(commission=commission)
@@ -81,13 +272,7 @@ def run_backtest(
 
     analyzers = {}
     if add_analyzers and results:
-        strat = results[0]
-        analyzers = {
-            'sharpe': strat.analyzers.sharpe.get_analysis() if hasattr(strat.analyzers, 'sharpe') else {},
-            'drawdown': strat.analyzers.drawdown.get_analysis() if hasattr(strat.analyzers, 'drawdown') else {},
-            'returns': strat.analyzers.returns.get_analysis() if hasattr(strat.analyzers, 'returns') else {},
-            'trades': strat.analyzers.trades.get_analysis() if hasattr(strat.analyzers, 'trades') else {},
-        }
+        analyzers = _extract_analyzers(results[0])
 
         if verbose:
             _print_analyzer_summary(analyzers)
@@ -100,6 +285,185 @@ def run_backtest(
     }
 
 
+def _run_vectorized(
+    symbols,
+    start_date: str,
+    end_date: str,
+    strategy_cls,
+    strategy_params: dict,
+    initial_cash: float,
+    commission: float,
+    cheat_on_close: bool,
+    verbose: bool,
+) -> dict:
+    """
+    向量化引擎入口：目前仅覆盖双均线策略（依赖 fast/slow 两个参数），
+    且持仓模型只在 cheat_on_close 撮合下与策略等价（见 _holding_mask）。
+    不支持的组合直接报错，绝不悄悄跑出错的结果。
+    仅支持单标的；组合回测仍走 backtrader 路径。
+    """
+    from .vector_engine import run_vectorized_dual_ma
+
+    if not cheat_on_close:
+        raise ValueError('vectorized 引擎仅支持 cheat_on_close=True（持仓模型按收盘撮合推导）')
+    if getattr(strategy_cls, '__name__', '') != 'DualMovingAverageStrategy':
+        raise ValueError(f"vectorized 引擎暂仅支持 DualMovingAverageStrategy，收到: {strategy_cls!r}")
+
+    symbols_list = symbols if isinstance(symbols, (list, tuple)) else [symbols]
+    if len(symbols_list) != 1:
+        raise ValueError('vectorized 引擎暂仅支持单标的回测')
+
+    # 取 fast/slow：优先用显式参数，否则退回策略类默认值（bt 的 params 是类属性）
+    cls_params = getattr(strategy_cls, 'params', None)
+    fast = int(strategy_params.get('fast', getattr(cls_params, 'fast', 5)))
+    slow = int(strategy_params.get('slow', getattr(cls_params, 'slow', 20)))
+
+    df = load_price_frame(str(symbols_list[0]), start_date, end_date)
+
+    if verbose:
+        print('初始资金:', round(initial_cash, 2))
+
+    result = run_vectorized_dual_ma(
+        close=df['Close'].to_numpy(),
+        fast=fast,
+        slow=slow,
+        initial_cash=initial_cash,
+        commission=commission,
+    )
+
+    if verbose:
+        print('结束资金:', result['final_value'])
+        _print_analyzer_summary(result['analyzers'])
+
+    return result
+
+
+def _extract_analyzers(strat) -> dict:
+    """把策略实例上的四个常用分析器取成嵌套 dict。"""
+    return {
+        'sharpe': strat.analyzers.sharpe.get_analysis() if hasattr(strat.analyzers, 'sharpe') else {},
+        'drawdown': strat.analyzers.drawdown.get_analysis() if hasattr(strat.analyzers, 'drawdown') else {},
+        'returns': strat.analyzers.returns.get_analysis() if hasattr(strat.analyzers, 'returns') else {},
+        'trades': strat.analyzers.trades.get_analysis() if hasattr(strat.analyzers, 'trades') else {},
+    }
+
+
+# 常驻评估服务的 worker 侧上下文：initializer 挂接共享内存后放在这里，
+# 同一 worker 的后续任务直接复用，不再碰 Mongo 也不再拷贝数据
+_EVAL_CTX = None
+
+
+def _eval_worker_init(meta: dict) -> None:
+    global _EVAL_CTX
+    shm = shared_memory.SharedMemory(name=meta['shm_name'])
+    block = np.ndarray(meta['shape'], dtype=np.dtype(meta['dtype']), buffer=shm.buf)
+    # 与 load_portfolio_block 相同的裁剪：上市前的 NaN 行不进 feed
+    views = {}
+    for j, sym in enumerate(meta['symbols']):
+        off = meta['offsets'][sym]
+        v = {field: block[i, off:, j] for i, field in enumerate(PORTFOLIO_FIELDS)}
+        v['datetimes'] = meta['dtnums'][off:]
+        views[sym] = v
+    # 保留 shm 引用防止被回收导致视图失效
+    _EVAL_CTX = dict(meta, shm=shm, views=views)
+
+
+def _eval_worker_run(strategy_cls, strategy_params: dict, symbols=None) -> dict:
+    ctx = _EVAL_CTX
+    cerebro = bt.Cerebro()
+    cerebro.addstrategy(strategy_cls, **strategy_params)
+    for s in (symbols or ctx['symbols']):
+        cerebro.adddata(ArrayData(**ctx['views'][str(s)]), name=str(s))
+
+    cerebro.broker.setcash(ctx['initial_cash'])
+    cerebro.broker.setcommission(commission=ctx['commission'])
+    cerebro.broker.set_coc(ctx['cheat_on_close'])
+
+    cerebro.addanalyzer(bt.analyzers.SharpeRatio, _name='sharpe', timeframe=bt.TimeFrame.Days)
+    cerebro.addanalyzer(bt.analyzers.DrawDown, _name='drawdown')
+    cerebro.addanalyzer(bt.analyzers.Returns, _name='returns')
+    cerebro.addanalyzer(bt.analyzers.TradeAnalyzer, _name='trades')
+
+    results = cerebro.run()
+    return {
+        'final_value': round(cerebro.broker.getvalue(), 2),
+        'analyzers': _extract_analyzers(results[0]) if results else {},
+    }
+
+
+class EvalService:
+    """
+    参数迭代用的常驻评估服务：
+    - 启动时把标的池的对齐价格块装进共享内存（load_portfolio_block 的
+      float32 块），预热一个进程池，每个 worker 挂接同一块内存
+    - 之后 evaluate/submit 只传 (strategy_cls, params)，worker 用共享
+      数组建 ArrayData 跑回测并返回 final_value + analyzers
+    数据一个会话只加载一次，改参数重跑的延迟就是回测本身的开销。
+    用法：
+        with EvalService(symbols, '20200101', '20250901', n_workers=8) as svc:
+            r = svc.evaluate(DualMovingAverageStrategy, dict(fast=5, slow=30))
+    """
+
+    def __init__(
+        self,
+        symbols,
+        start_date: str,
+        end_date: str,
+        n_workers: int = None,
+        initial_cash: float = 100000.0,
+        commission: float = 0.001,
+        cheat_on_close: bool = True,
+    ):
+        pf = load_portfolio_block(symbols, start_date, end_date)
+        block = pf['block']
+        self._shm = shared_memory.SharedMemory(create=True, size=block.nbytes)
+        shm_block = np.ndarray(block.shape, dtype=block.dtype, buffer=self._shm.buf)
+        shm_block[:] = block
+
+        meta = dict(
+            shm_name=self._shm.name,
+            shape=block.shape,
+            dtype=str(block.dtype),
+            symbols=pf['symbols'],
+            offsets=pf['offsets'],
+            dtnums=_dates_to_btnum(pf['dates']),
+            initial_cash=initial_cash,
+            commission=commission,
+            cheat_on_close=cheat_on_close,
+        )
+        self.symbols = pf['symbols']
+        self._pool = ProcessPoolExecutor(
+            max_workers=n_workers, initializer=_eval_worker_init, initargs=(meta,))
+        print(f"评估服务就绪: {len(self.symbols)} 标的 × {block.shape[1]} bar，"
+              f"共享内存 {block.nbytes / 1e6:.1f}MB")
+
+    def submit(self, strategy_cls, strategy_params=None, symbols=None):
+        """异步提交一次评估，返回 Future（结果同 evaluate）。"""
+        return self._pool.submit(
+            _eval_worker_run, strategy_cls, strategy_params or {}, symbols)
+
+    def evaluate(self, strategy_cls, strategy_params=None, symbols=None) -> dict:
+        """
+        同步评估一组策略参数：symbols 不传则用整个标的池。
+        返回 {'final_value', 'analyzers'}，analyzers 结构同 run_backtest。
+        """
+        return self.submit(strategy_cls, strategy_params, symbols).result()
+
+    def close(self) -> None:
+        self._pool.shutdown(wait=True)
+        self._shm.close()
+        try:
+            self._shm.unlink()
+        except FileNotFoundError:
+            pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
 def _safe_get(dct, path, default=None):
     cur = dct
     for key in path:
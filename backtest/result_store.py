@@ -0,0 +1,89 @@
+"""
+网格回测结果的增量列式存储：
+- 每个完成的 (symbol, strategy, fast, slow, start, end) 单元写一个独立
+  的小 Parquet 文件（tmp + rename 原子落盘），批跑中途崩溃不丢已完成单元
+- 文件名即去重键：同一单元重跑直接覆盖，不像 CSV 追加那样产生重复行
+- 读取时 lazy 合并全部记录文件；崩溃后重跑可据 completed() 跳过已完成单元
+"""
+import os
+import shutil
+from pathlib import Path
+
+import pandas as pd
+
+KEY_FIELDS = ('symbol', 'strategy', 'fast', 'slow', 'start_date', 'end_date')
+
+
+class ResultStore:
+    def __init__(self, store_dir: str = 'ma_grid_store'):
+        self.root = Path(store_dir)
+        self.records_dir = self.root / 'records'
+        self.records_dir.mkdir(parents=True, exist_ok=True)
+        # tested/last_run 状态：每标的一个小文件，分片机各写各的，
+        # 合并时取最新，不再多机争抢一个 symbols.csv
+        self.state_dir = self.root / 'state'
+        self.state_dir.mkdir(parents=True, exist_ok=True)
+
+    @staticmethod
+    def cell_key(symbol, strategy, fast, slow, start_date, end_date) -> str:
+        """单元的稳定去重键，同时用作记录文件名。"""
+        return f"{symbol}_{strategy}_{fast}_{slow}_{start_date}_{end_date}"
+
+    def add(self, record: dict) -> None:
+        """原子写入一个完成单元的记录；重复写入覆盖旧记录。"""
+        key = self.cell_key(*(record[f] for f in KEY_FIELDS))
+        path = self.records_dir / f"{key}.parquet"
+        tmp = path.with_suffix('.parquet.tmp')
+        pd.DataFrame([record]).to_parquet(tmp, index=False)
+        os.replace(tmp, path)
+
+    def completed(self) -> set:
+        """已完成单元的键集合（崩溃重跑时跳过用）。"""
+        return {p.stem for p in self.records_dir.glob('*.parquet')}
+
+    def load(self) -> pd.DataFrame:
+        """合并全部记录为一个 DataFrame（键唯一，无重复行）。"""
+        paths = sorted(self.records_dir.glob('*.parquet'))
+        if not paths:
+            return pd.DataFrame()
+        df = pd.concat([pd.read_parquet(p) for p in paths], ignore_index=True)
+        return df.drop_duplicates(subset=list(KEY_FIELDS), keep='last')
+
+    def mark_tested(self, symbol: str, when=None) -> None:
+        """标记标的已跑完本批全部单元（原子写，一标的一文件）。"""
+        when = when if when is not None else pd.Timestamp.now()
+        path = self.state_dir / f"{symbol}.txt"
+        tmp = path.with_suffix('.txt.tmp')
+        tmp.write_text(str(when), encoding='utf-8')
+        os.replace(tmp, path)
+
+    def tested_symbols(self) -> dict:
+        """{symbol: last_run 字符串}；pending 模式据此跳过已完成标的。"""
+        out = {}
+        for p in self.state_dir.glob('*.txt'):
+            out[p.stem] = p.read_text(encoding='utf-8').strip()
+        return out
+
+
+def merge_stores(shard_dirs, merged_dir: str) -> 'ResultStore':
+    """
+    合并多台机器的分片结果库：
+    - 记录文件按文件名（即去重键）合并，同键以 mtime 较新者为准
+    - tested 状态逐标的合并，last_run 取较新值
+    返回合并后的 ResultStore。
+    """
+    merged = ResultStore(merged_dir)
+    for d in shard_dirs:
+        shard = ResultStore(d)
+        for p in shard.records_dir.glob('*.parquet'):
+            dest = merged.records_dir / p.name
+            if dest.exists() and dest.stat().st_mtime >= p.stat().st_mtime:
+                continue
+            tmp = dest.with_suffix('.parquet.tmp')
+            shutil.copy2(p, tmp)
+            os.replace(tmp, dest)
+        existing = merged.tested_symbols()
+        for sym, when in shard.tested_symbols().items():
+            if sym not in existing or when > existing[sym]:
+                merged.mark_tested(sym, when)
+    return merged
@@ -0,0 +1,84 @@
+"""
+网格结果查询接口：
+- 架在 ResultStore 的列式记录之上，替代"grep 几百 MB CSV"的用法
+- 帧只在记录集变化时重载（按记录数 + 最新 mtime 判断），重复查询
+  走内存缓存与 (symbol) 分组索引，毫秒级返回
+"""
+from pathlib import Path
+
+import pandas as pd
+
+from backtest.result_store import ResultStore
+
+
+class ResultsDB:
+    def __init__(self, store_dir: str = 'ma_grid_store'):
+        self.store = ResultStore(store_dir)
+        self._df = None
+        self._sig = None
+
+    # ---------- 内部 ----------
+    def _signature(self):
+        paths = list(self.store.records_dir.glob('*.parquet'))
+        latest = max((p.stat().st_mtime for p in paths), default=0.0)
+        return (len(paths), latest)
+
+    def _frame(self) -> pd.DataFrame:
+        sig = self._signature()
+        if self._df is None or sig != self._sig:
+            df = self.store.load()
+            if not df.empty:
+                df = df.set_index('symbol', drop=False).sort_index()
+            self._df = df
+            self._sig = sig
+        return self._df
+
+    @staticmethod
+    def _apply_date_filter(df: pd.DataFrame, start_date=None, end_date=None) -> pd.DataFrame:
+        if start_date is not None:
+            df = df[df['start_date'].astype(str) >= str(start_date)]
+        if end_date is not None:
+            df = df[df['end_date'].astype(str) <= str(end_date)]
+        return df
+
+    # ---------- 查询 API ----------
+    def best_params(self, symbol: str, metric: str = 'sharpe', n: int = 3,
+                    start_date=None, end_date=None) -> pd.DataFrame:
+        """某标的按 metric 降序的前 n 组 (fast, slow)。"""
+        df = self._frame()
+        if df.empty or str(symbol) not in df.index:
+            return pd.DataFrame()
+        sub = df.loc[[str(symbol)]]
+        sub = self._apply_date_filter(sub, start_date, end_date)
+        return sub.sort_values(metric, ascending=False).head(n).reset_index(drop=True)
+
+    def param_stability(self, fast: int, slow: int, metric: str = 'sharpe',
+                        start_date=None, end_date=None) -> dict:
+        """
+        某组 (fast, slow) 在全体标的上的稳定性：
+        均值/标准差/中位数/正收益占比/样本数。
+        """
+        df = self._frame()
+        if df.empty:
+            return {}
+        sub = df[(df['fast'] == fast) & (df['slow'] == slow)]
+        sub = self._apply_date_filter(sub, start_date, end_date)
+        vals = pd.to_numeric(sub[metric], errors='coerce').dropna()
+        if vals.empty:
+            return {'count': 0}
+        return {
+            'count': int(len(vals)),
+            'mean': float(vals.mean()),
+            'std': float(vals.std()),
+            'median': float(vals.median()),
+            'positive_share': float((vals > 0).mean()),
+        }
+
+    def top_overall(self, metric: str = 'sharpe', n: int = 20,
+                    start_date=None, end_date=None) -> pd.DataFrame:
+        """全库按 metric 降序的前 n 条记录（批跑后打印摘要用）。"""
+        df = self._frame()
+        if df.empty:
+            return df
+        df = self._apply_date_filter(df, start_date, end_date)
+        return df.sort_values(metric, ascending=False).head(n).reset_index(drop=True)
@@ -0,0 +1,182 @@
+"""
+向量化双均线回测引擎：
+- 不经过 bt.Cerebro 的逐 bar Python 循环，直接对整条价格序列做数组运算
+- 输出与 backtrader 版 run_backtest 相同结构的 analyzers 字典（sharpe/drawdown/returns/trades）
+- backtrader 引擎保留为正确性对照基准
+"""
+import math
+import os
+import sys
+
+import numpy as np
+
+# 共享指标内核（与因子管线、临时脚本同一套实现）
+sys.path.append(os.path.dirname(os.path.dirname(__file__)))
+from indicators import rolling_mean
+
+
+def sma(values: np.ndarray, period: int) -> np.ndarray:
+    """
+    简单移动平均（委托给共享内核，前 period-1 个位置为 NaN）。
+    用 float64 输出：持仓掩码靠 sma_fast > sma_slow 判交叉，交叉 bar
+    正是近平局 bar，降到 float32 会相对 backtrader 参考实现偏移一根。
+    """
+    return rolling_mean(values, period, dtype=np.float64)
+
+
+def _holding_mask(close: np.ndarray, fast: int, slow: int) -> np.ndarray:
+    """
+    复刻 DualMovingAverageStrategy 的持仓逻辑：
+    - 空仓时只要 sma_fast > sma_slow（且均线就绪）即买入
+    - 持仓时仅在 fast 下穿 slow 时清仓
+    在 cheat_on_close 撮合下等价于 "sma_fast > sma_slow 即持仓"。
+    """
+    sma_fast = sma(close, fast)
+    sma_slow = sma(close, slow)
+    with np.errstate(invalid='ignore'):
+        holding = sma_fast > sma_slow
+    return holding
+
+
+def _simulate_equity(close: np.ndarray, holding: np.ndarray, initial_cash: float, commission: float):
+    """
+    按持仓段模拟资金曲线：交易段数远小于 bar 数，段内按数组切片填充。
+    返回 (equity 曲线, 交易列表[(净盈亏,)])。
+    """
+    equity = np.empty(len(close), dtype=np.float64)
+    cash = initial_cash
+    trades = []
+
+    # 持仓段边界：diff 为 1 的位置开仓，为 -1 的位置平仓
+    flags = holding.astype(np.int8)
+    change = np.diff(np.concatenate(([0], flags)))
+    entries = np.flatnonzero(change == 1)
+    exits = np.flatnonzero(change == -1)
+
+    pos = 0
+    for i, entry in enumerate(entries):
+        exit_idx = exits[i] if i < len(exits) else None
+
+        # 开仓前的空仓段
+        equity[pos:entry] = cash
+
+        # 与策略一致：99% 现金整数股，收盘价成交
+        price = close[entry]
+        size = int((cash * 0.99) / price)
+        if size <= 0:
+            end = exit_idx if exit_idx is not None else len(close)
+            equity[entry:end] = cash
+            pos = end
+            continue
+
+        buy_cost = size * price
+        buy_comm = buy_cost * commission
+        cash_rem = cash - buy_cost - buy_comm
+
+        end = exit_idx if exit_idx is not None else len(close)
+        equity[entry:end] = cash_rem + size * close[entry:end]
+
+        if exit_idx is not None:
+            sell_price = close[exit_idx]
+            sell_comm = size * sell_price * commission
+            cash = cash_rem + size * sell_price - sell_comm
+            equity[exit_idx] = cash
+            pnl_net = size * (sell_price - price) - buy_comm - sell_comm
+            trades.append(pnl_net)
+            pos = exit_idx + 1
+        else:
+            # 结束时仍持仓，不计入已平仓交易
+            pos = len(close)
+
+    if pos < len(close):
+        equity[pos:] = cash
+    return equity, trades
+
+
+def _build_analyzers(equity: np.ndarray, trades, initial_cash: float) -> dict:
+    """把资金曲线与交易列表折算成 backtrader 分析器风格的嵌套 dict。"""
+    final_value = float(equity[-1]) if len(equity) else initial_cash
+
+    # —— returns（对齐 bt.analyzers.Returns：对数收益口径）——
+    rtot = math.log(final_value / initial_cash) if final_value > 0 else None
+    n_bars = max(len(equity), 1)
+    ravg = (rtot / n_bars) if rtot is not None else None
+    rnorm = (math.exp(ravg * 252) - 1) if ravg is not None else None
+    returns = {
+        'rtot': rtot,
+        'ravg': ravg,
+        'rnorm': rnorm,
+        'rnorm100': (rnorm * 100.0) if rnorm is not None else None,
+    }
+
+    # —— sharpe（对齐 bt.analyzers.SharpeRatio 默认：日频、年化无风险利率 1%、不年化）——
+    sharpe_ratio = None
+    if len(equity) > 2:
+        rets = np.diff(equity) / equity[:-1]
+        std = rets.std(ddof=1)
+        if std > 0:
+            rf_daily = 0.01 / 252.0
+            sharpe_ratio = float((rets.mean() - rf_daily) / std)
+    sharpe = {'sharperatio': sharpe_ratio}
+
+    # —— drawdown ——
+    peak = np.maximum.accumulate(equity) if len(equity) else np.array([initial_cash])
+    dd_money = peak - equity if len(equity) else np.array([0.0])
+    with np.errstate(divide='ignore', invalid='ignore'):
+        dd_pct = np.where(peak > 0, dd_money / peak * 100.0, 0.0)
+    drawdown = {
+        'max': {
+            'drawdown': float(dd_pct.max()) if len(equity) else 0.0,
+            'moneydown': float(dd_money.max()) if len(equity) else 0.0,
+        }
+    }
+
+    # —— trades（仅统计已平仓交易，口径同 TradeAnalyzer）——
+    won = [p for p in trades if p > 0]
+    lost = [p for p in trades if p <= 0]
+    trades_dict = {
+        'total': {'total': len(trades)},
+        'won': {'total': len(won)},
+        'lost': {'total': len(lost)},
+        'pnl': {
+            'won': {'total': float(sum(won))},
+            'lost': {'total': float(sum(lost))},
+        },
+    }
+
+    return {
+        'sharpe': sharpe,
+        'drawdown': drawdown,
+        'returns': returns,
+        'trades': trades_dict,
+    }
+
+
+def run_vectorized_dual_ma(
+    close: np.ndarray,
+    fast: int,
+    slow: int,
+    initial_cash: float = 100000.0,
+    commission: float = 0.001,
+) -> dict:
+    """
+    对单条收盘价序列跑双均线回测（全程数组运算）。
+    返回：dict，含 final_value 与 analyzers（结构同 backtrader 路径）。
+    """
+    close = np.asarray(close, dtype=np.float64)
+    if len(close) == 0:
+        return {
+            'cerebro': None,
+            'results': [],
+            'final_value': round(initial_cash, 2),
+            'analyzers': _build_analyzers(np.array([initial_cash]), [], initial_cash),
+        }
+
+    holding = _holding_mask(close, fast, slow)
+    equity, trades = _simulate_equity(close, holding, initial_cash, commission)
+    return {
+        'cerebro': None,
+        'results': [],
+        'final_value': round(float(equity[-1]), 2),
+        'analyzers': _build_analyzers(equity, trades, initial_cash),
+    }
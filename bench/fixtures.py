@@ -0,0 +1,63 @@
+"""
+基准测试夹具：确定性合成数据，不碰网络也不碰 Mongo。
+同一 seed 生成的数据逐位一致，保证跨运行可比。
+"""
+import zlib
+
+import numpy as np
+import pandas as pd
+import polars as pl
+
+
+def make_price_frame(symbol: str, n_bars: int, seed: int = 0) -> pd.DataFrame:
+    """合成单标的日线（几何随机游走），结构与 load_price_frame 输出一致。"""
+    # crc32 是稳定摘要；内置 hash 对字符串有进程级盐，跨运行不可复现
+    rng = np.random.default_rng(zlib.crc32(symbol.encode('utf-8')) + seed)
+    rets = rng.normal(0.0003, 0.02, n_bars)
+    close = 10.0 * np.exp(np.cumsum(rets))
+    spread = np.abs(rng.normal(0.005, 0.003, n_bars))
+    df = pd.DataFrame({
+        'Open': close * (1 + rng.normal(0, 0.004, n_bars)),
+        'High': close * (1 + spread),
+        'Low': close * (1 - spread),
+        'Close': close,
+        'Volume': rng.integers(1_000_00, 5_000_000, n_bars).astype(float),
+    }, index=pd.bdate_range('2020-01-01', periods=n_bars))
+    df.index.name = 'datetime'
+    return df
+
+
+def make_stocks_parquet(path, n_symbols: int, n_bars: int, seed: int = 0) -> None:
+    """合成 AlphaProject 长表数据集（date/code/open/high/low/close/volume/turnover）。"""
+    rng = np.random.default_rng(seed)
+    dates = pd.bdate_range('2020-01-01', periods=n_bars).date
+    frames = []
+    for i in range(n_symbols):
+        code = f"{600000 + i:06d}"
+        rets = rng.normal(0.0003, 0.02, n_bars)
+        close = 10.0 * np.exp(np.cumsum(rets))
+        frames.append(pl.DataFrame({
+            'date': list(dates),
+            'code': [code] * n_bars,
+            'open': (close * (1 + rng.normal(0, 0.004, n_bars))).astype(np.float32),
+            'high': (close * 1.01).astype(np.float32),
+            'low': (close * 0.99).astype(np.float32),
+            'close': close.astype(np.float32),
+            'volume': rng.integers(100_000, 5_000_000, n_bars).astype(np.float32),
+            'turnover': rng.uniform(0.5, 20.0, n_bars).astype(np.float32),
+        }))
+    pl.concat(frames).sort(['code', 'date']).write_parquet(path)
+
+
+def make_trade_log(path, n_lines: int, seed: int = 0) -> None:
+    """合成调仓日志（与 parse_trade_log 期望的 | 分隔格式一致），夹杂噪声行。"""
+    rng = np.random.default_rng(seed)
+    with open(path, 'w', encoding='utf-8') as f:
+        for i in range(n_lines):
+            if i % 10 == 0:
+                f.write("INFO engine heartbeat ok\n")  # 非调仓噪声行
+            code = f"{rng.integers(0, 5000):06d}.{'SZ' if rng.random() < 0.5 else 'SH'}"
+            delta = int(rng.integers(-5000, 5000))
+            price = round(float(rng.uniform(2, 200)), 2)
+            v1 = int(rng.integers(0, 100000))
+            f.write(f"{code}|{delta}|20250901|09:30:00|{v1}|0|{price}\n")
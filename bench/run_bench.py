@@ -0,0 +1,137 @@
+"""
+基准测试入口：对关键路径计时并与上一次同规模结果对比。
+
+    python bench/run_bench.py --scale small    # 50 标的
+    python bench/run_bench.py --scale medium   # 500 标的
+    python bench/run_bench.py --scale large    # 5000 标的
+
+- 全部数据来自 bench/fixtures.py 的确定性合成夹具（无网络、无 Mongo）
+- 每次运行追加一行 JSON 到 bench/bench_history.jsonl
+- 打印与上一次同规模运行的耗时对比（回归一目了然）
+"""
+import argparse
+import json
+import sys
+import tempfile
+import time
+from datetime import datetime
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent.parent
+sys.path.insert(0, str(ROOT))
+
+from bench.fixtures import make_price_frame, make_stocks_parquet, make_trade_log
+
+SCALES = {
+    'small': dict(n_symbols=50, n_bars=750),
+    'medium': dict(n_symbols=500, n_bars=1500),
+    'large': dict(n_symbols=5000, n_bars=1500),
+}
+HISTORY_PATH = Path(__file__).parent / 'bench_history.jsonl'
+
+
+def _timed(fn):
+    t0 = time.perf_counter()
+    fn()
+    return round(time.perf_counter() - t0, 4)
+
+
+def bench_vectorized_backtest(n_symbols, n_bars):
+    from backtest.vector_engine import run_vectorized_dual_ma
+
+    frames = [make_price_frame(f"{600000 + i:06d}", n_bars) for i in range(n_symbols)]
+
+    def run():
+        for df in frames:
+            for fast, slow in ((5, 30), (10, 50), (20, 100)):
+                run_vectorized_dual_ma(df['Close'].to_numpy(), fast, slow)
+    return _timed(run)
+
+
+def bench_indicator_kernels(n_symbols, n_bars):
+    from indicators import rolling_mean, rolling_std, ema, crossover
+
+    closes = [make_price_frame(f"{600000 + i:06d}", n_bars)['Close'].to_numpy()
+              for i in range(n_symbols)]
+
+    def run():
+        for c in closes:
+            fast = rolling_mean(c, 5)
+            slow = rolling_mean(c, 20)
+            rolling_std(c, 20)
+            ema(c, 12)
+            crossover(fast, slow)
+    return _timed(run)
+
+
+def bench_factor_pipeline(n_symbols, n_bars, tmp_dir):
+    import polars as pl
+    from AlphaProject.src.factors import compute_factors_lazy, process_cross_section
+
+    data_path = Path(tmp_dir) / 'stocks.parquet'
+    make_stocks_parquet(data_path, n_symbols, n_bars)
+
+    def run():
+        lf = compute_factors_lazy(str(data_path))
+        process_cross_section(lf).collect(streaming=True)
+    return _timed(run)
+
+
+def bench_parse_trade_log(n_symbols, n_bars, tmp_dir):
+    sys.path.insert(0, str(ROOT / 'test'))
+    from parse_trade_log import parse_trade_log
+
+    log_path = Path(tmp_dir) / 'ta_bench.log'
+    make_trade_log(log_path, n_lines=n_symbols * 20)
+    return _timed(lambda: parse_trade_log(str(log_path)))
+
+
+def load_previous(scale):
+    if not HISTORY_PATH.exists():
+        return None
+    prev = None
+    with open(HISTORY_PATH, 'r', encoding='utf-8') as f:
+        for line in f:
+            rec = json.loads(line)
+            if rec.get('scale') == scale:
+                prev = rec
+    return prev
+
+
+def main():
+    parser = argparse.ArgumentParser(description='性能基准测试')
+    parser.add_argument('--scale', choices=list(SCALES), default='small')
+    args = parser.parse_args()
+    cfg = SCALES[args.scale]
+
+    results = {}
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        print(f"规模: {args.scale} ({cfg['n_symbols']} 标的 × {cfg['n_bars']} bar)")
+        results['vectorized_backtest'] = bench_vectorized_backtest(**cfg)
+        results['indicator_kernels'] = bench_indicator_kernels(**cfg)
+        results['factor_pipeline'] = bench_factor_pipeline(tmp_dir=tmp_dir, **cfg)
+        results['parse_trade_log'] = bench_parse_trade_log(tmp_dir=tmp_dir, **cfg)
+
+    prev = load_previous(args.scale)
+    print(f"\n{'benchmark':<24}{'seconds':>10}{'prev':>10}{'delta':>10}")
+    for name, secs in results.items():
+        prev_secs = (prev or {}).get('results', {}).get(name)
+        if prev_secs:
+            delta = f"{(secs - prev_secs) / prev_secs * 100:+.1f}%"
+            print(f"{name:<24}{secs:>10.4f}{prev_secs:>10.4f}{delta:>10}")
+        else:
+            print(f"{name:<24}{secs:>10.4f}{'-':>10}{'-':>10}")
+
+    record = {
+        'timestamp': datetime.now().isoformat(),
+        'scale': args.scale,
+        **cfg,
+        'results': results,
+    }
+    with open(HISTORY_PATH, 'a', encoding='utf-8') as f:
+        f.write(json.dumps(record, ensure_ascii=False) + '\n')
+    print(f"\n结果已追加至: {HISTORY_PATH}")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,2 @@
+# 统一的滚动指标内核（数组进/数组出）
+from .kernels import rolling_mean, rolling_std, ema, atr, crossover
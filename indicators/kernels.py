@@ -0,0 +1,121 @@
+"""
+滚动指标内核：统一的"连续数组进、连续数组出"API。
+
+- 向量化回测引擎、基准测试与临时数组分析共用这一套实现
+- AlphaProject 的因子管线是有意的例外：它继续用 Polars 的
+  rolling_mean/rolling_std 表达式——改走 numpy 内核会把惰性图切断、
+  破坏 streaming 执行（见 process_cross_section 的流式设计）。两边的窗口语义
+  保持一致（窗口未满的前缀为 NaN），数值口径可互相对轧
+- 全部单遍 O(n)：均值/标准差走 cumsum，EMA/ATR 走一阶递推
+- 输入任意 float 数组，内部用 float64 累加保证精度，输出默认
+  float32（dtype 参数可要求 float64，见 rolling_mean）
+- 装了 numba 时递推内核自动 JIT，没装则退回纯 numpy/Python
+"""
+import numpy as np
+
+try:
+    from numba import njit
+    _HAS_NUMBA = True
+except ImportError:
+    _HAS_NUMBA = False
+
+    def njit(*args, **kwargs):
+        # 无 numba 时的直通装饰器
+        if args and callable(args[0]):
+            return args[0]
+        return lambda fn: fn
+
+
+def _as_f64(values) -> np.ndarray:
+    return np.ascontiguousarray(values, dtype=np.float64)
+
+
+def rolling_mean(values, period: int, dtype=np.float32) -> np.ndarray:
+    """
+    滚动均值（cumsum 单遍）。前 period-1 个位置为 NaN。
+    dtype 为输出精度：存储/喂 feed 用默认 float32；要与 float64 参考
+    实现逐位可比（如与 backtrader 对轧交叉点）时传 np.float64。
+    """
+    x = _as_f64(values)
+    out = np.full(len(x), np.nan, dtype=dtype)
+    if period <= 0 or len(x) < period:
+        return out
+    csum = np.cumsum(x)
+    out[period - 1:] = ((csum[period - 1:] - np.concatenate(([0.0], csum[:-period]))) / period).astype(dtype)
+    return out
+
+
+def rolling_std(values, period: int, ddof: int = 1, dtype=np.float32) -> np.ndarray:
+    """滚动标准差（x 与 x^2 的 cumsum，单遍）。默认样本标准差（ddof=1）。
+    dtype 同 rolling_mean。"""
+    x = _as_f64(values)
+    out = np.full(len(x), np.nan, dtype=dtype)
+    if period <= ddof or len(x) < period:
+        return out
+    csum = np.cumsum(x)
+    csum2 = np.cumsum(x * x)
+    s = csum[period - 1:] - np.concatenate(([0.0], csum[:-period]))
+    s2 = csum2[period - 1:] - np.concatenate(([0.0], csum2[:-period]))
+    var = (s2 - s * s / period) / (period - ddof)
+    np.maximum(var, 0.0, out=var)  # 浮点误差可能产生轻微负数
+    out[period - 1:] = np.sqrt(var).astype(dtype)
+    return out
+
+
+@njit(cache=True)
+def _ewm_recursive(x, alpha, out):
+    prev = x[0]
+    out[0] = prev
+    for i in range(1, len(x)):
+        prev = alpha * x[i] + (1.0 - alpha) * prev
+        out[i] = prev
+
+
+def ema(values, period: int) -> np.ndarray:
+    """指数移动平均，alpha = 2/(period+1)，以首个值为种子。"""
+    x = _as_f64(values)
+    out = np.empty(len(x), dtype=np.float64)
+    if len(x) == 0:
+        return out.astype(np.float32)
+    _ewm_recursive(x, 2.0 / (period + 1.0), out)
+    return out.astype(np.float32)
+
+
+def atr(high, low, close, period: int = 14) -> np.ndarray:
+    """
+    平均真实波幅：真实波幅向量化，随后按 Wilder 平滑（alpha=1/period）。
+    首个位置的 TR 取 high-low。
+    """
+    h = _as_f64(high)
+    l = _as_f64(low)
+    c = _as_f64(close)
+    tr = h - l
+    if len(c) > 1:
+        prev_close = c[:-1]
+        tr[1:] = np.maximum(tr[1:], np.maximum(np.abs(h[1:] - prev_close), np.abs(l[1:] - prev_close)))
+    out = np.empty(len(tr), dtype=np.float64)
+    if len(tr) == 0:
+        return out.astype(np.float32)
+    _ewm_recursive(tr, 1.0 / period, out)
+    return out.astype(np.float32)
+
+
+def crossover(fast, slow) -> np.ndarray:
+    """
+    交叉检测：+1 上穿，-1 下穿，0 无交叉（int8）。
+    任一侧为 NaN 的位置输出 0。
+    """
+    f = _as_f64(fast)
+    s = _as_f64(slow)
+    with np.errstate(invalid='ignore'):
+        above = f > s
+        below = f < s
+    valid = ~(np.isnan(f) | np.isnan(s))
+    out = np.zeros(len(f), dtype=np.int8)
+    if len(f) < 2:
+        return out
+    up = above[1:] & below[:-1] & valid[1:] & valid[:-1]
+    down = below[1:] & above[:-1] & valid[1:] & valid[:-1]
+    out[1:][up] = 1
+    out[1:][down] = -1
+    return out
@@ -1,10 +1,95 @@
 # market_data_db.py
-from pymongo import MongoClient, ASCENDING
-from pymongo.errors import DuplicateKeyError
+import os
+
+from pymongo import MongoClient, ASCENDING, DESCENDING, UpdateOne
+from pymongo.errors import BulkWriteError
 import pandas as pd
 from datetime import datetime, date
 
+# 可选的列式解码后端：有 pymongoarrow 时 BSON 直接解码为 Arrow 列，
+# 完全跳过逐文档 dict 的中间态；没有则退回单遍按列累积。
+try:
+    from pymongoarrow.api import find_pandas_all
+    _HAS_PYMONGOARROW = True
+except ImportError:
+    _HAS_PYMONGOARROW = False
+
+# K线集合固定模式：列名 -> 目标 dtype（缺失列自动跳过）
+KLINE_SCHEMA = {
+    'symbol': 'object',
+    'stock_code': 'object',
+    'datetime': 'datetime64[ns]',
+    'open': 'float64',
+    'high': 'float64',
+    'low': 'float64',
+    'close': 'float64',
+    'volume': 'float64',
+    'turnover': 'float64',
+    'amplitude': 'float64',
+    'pct_change': 'float64',
+    'change': 'float64',
+    'turnover_rate': 'float64',
+}
+
+
+def _coerce_kline_dtypes(df: pd.DataFrame) -> pd.DataFrame:
+    """按 KLINE_SCHEMA 把各列转到固定类型（整帧一次，不逐文档）。"""
+    for col, dtype in KLINE_SCHEMA.items():
+        if col not in df.columns:
+            continue
+        if dtype == 'datetime64[ns]':
+            df[col] = pd.to_datetime(df[col], errors='coerce')
+        elif dtype == 'float64':
+            df[col] = pd.to_numeric(df[col], errors='coerce')
+    return df
+
+
+# 覆盖元数据集合：每个 (collection, symbol) 一个文档，intervals 为已入库
+# 的日期区间列表，插入/删除时同步维护，查询前 O(1) 判断缺口
+COVERAGE_COLLECTION = 'coverage_meta'
+# 区间减法用的开放端点哨兵（delete 不带时间范围时视为全区间）
+_COVERAGE_MIN = datetime(1970, 1, 1)
+_COVERAGE_MAX = datetime(2100, 1, 1)
+
+
+def _merge_intervals(intervals, adjacency=None):
+    """合并重叠/相邻（间隔 <= 1 天）的 [start, end] 区间，返回排序后的列表。"""
+    if adjacency is None:
+        adjacency = pd.Timedelta(days=1)
+    merged = []
+    for s, e in sorted(intervals):
+        if merged and s <= merged[-1][1] + adjacency:
+            if e > merged[-1][1]:
+                merged[-1][1] = e
+        else:
+            merged.append([s, e])
+    return merged
+
+
+def _decode_cursor_columnar(cursor, columns) -> pd.DataFrame:
+    """
+    pymongoarrow 不可用时的退路：对游标做单次遍历，按列累积后一次性
+    建帧并转型，省掉 list[dict] -> DataFrame 的中间全量拷贝。
+    """
+    cols = {c: [] for c in columns}
+    n = 0
+    for doc in cursor:
+        for c in columns:
+            cols[c].append(doc.get(c))
+        n += 1
+    if n == 0:
+        return pd.DataFrame(columns=list(columns))
+    return _coerce_kline_dtypes(pd.DataFrame(cols))
+
+
 class MarketDataDB:
+    # 进程级共享实例注册表：键含 pid，fork 出的 worker 各自重建客户端
+    # （MongoClient 不能跨 fork 复用 socket）
+    _shared_instances = {}
+    # 已确认过的索引备忘：(pid, collection, keys, unique)，避免每次读数据
+    # 都发一轮 createIndex
+    _ensured_indexes = set()
+
     def __init__(self, host='localhost', port=27017, db_name='market_data', username=None, password=None):
         """
         初始化 MongoDB 连接
@@ -15,21 +100,153 @@ class MarketDataDB:
             self.client = MongoClient(host=host, port=port)
         self.db = self.client[db_name]
 
+    @classmethod
+    def shared(cls, host='localhost', port=27017, db_name='market_data', username=None, password=None):
+        """
+        取进程内共享实例：同参数复用同一个 MongoClient（自带连接池），
+        避免每次数据加载都做 TCP 握手。fork 安全——子进程首次调用时
+        会新建自己的客户端。
+        """
+        key = (os.getpid(), host, port, db_name, username)
+        inst = cls._shared_instances.get(key)
+        if inst is None:
+            inst = cls(host=host, port=port, db_name=db_name, username=username, password=password)
+            cls._shared_instances[key] = inst
+        return inst
+
     def ensure_index(self, collection_name, keys=[('symbol', ASCENDING), ('datetime', ASCENDING)], unique=False):
         """
-        创建索引，避免重复数据，提高查询速度
+        创建索引，避免重复数据，提高查询速度。
+        每个 (进程, 集合, 键) 只发一次 createIndex，之后直接跳过。
         """
+        memo_key = (os.getpid(), self.db.name, collection_name, tuple(keys), unique)
+        if memo_key in MarketDataDB._ensured_indexes:
+            return
         collection = self.db[collection_name]
         collection.create_index(keys, unique=unique)
+        MarketDataDB._ensured_indexes.add(memo_key)
+
+    # --------------------------
+    # 覆盖元数据：O(1) 判断某标的某区间是否已入库
+    # --------------------------
+    def _coverage_coll(self):
+        self.ensure_index(
+            COVERAGE_COLLECTION,
+            keys=[('collection', ASCENDING), ('symbol', ASCENDING)],
+            unique=True,
+        )
+        return self.db[COVERAGE_COLLECTION]
+
+    def get_coverage(self, collection_name, symbol):
+        """返回某 (集合, 标的) 已覆盖的 [(start, end), ...] 区间列表（已排序）。"""
+        doc = self._coverage_coll().find_one(
+            {'collection': collection_name, 'symbol': symbol})
+        if not doc:
+            return []
+        return [(pd.to_datetime(s), pd.to_datetime(e)) for s, e in doc.get('intervals', [])]
+
+    def add_coverage(self, collection_name, symbol, start, end):
+        """
+        登记区间已覆盖。注意登记的是"请求过的范围"而非数据的 min/max——
+        纯节假日区间拉回来是空的，也要记下来，避免下次重复拉取。
+        """
+        start = pd.to_datetime(start)
+        end = pd.to_datetime(end)
+        if end < start:
+            return
+        intervals = [[s, e] for s, e in self.get_coverage(collection_name, symbol)]
+        intervals.append([start, end])
+        merged = _merge_intervals(intervals)
+        self._coverage_coll().update_one(
+            {'collection': collection_name, 'symbol': symbol},
+            {'$set': {'intervals': [[s.to_pydatetime(), e.to_pydatetime()] for s, e in merged]}},
+            upsert=True,
+        )
+
+    def remove_coverage(self, collection_name, symbol, start=None, end=None):
+        """从覆盖记录中减去 [start, end]；两端都不传则整标的记录删除。"""
+        if start is None and end is None:
+            self._coverage_coll().delete_one(
+                {'collection': collection_name, 'symbol': symbol})
+            return
+        start = pd.to_datetime(start) if start else pd.Timestamp(_COVERAGE_MIN)
+        end = pd.to_datetime(end) if end else pd.Timestamp(_COVERAGE_MAX)
+        one_day = pd.Timedelta(days=1)
+        kept = []
+        for s, e in self.get_coverage(collection_name, symbol):
+            if e < start or s > end:
+                kept.append([s, e])
+                continue
+            if s < start:
+                kept.append([s, start - one_day])
+            if e > end:
+                kept.append([end + one_day, e])
+        if kept:
+            self._coverage_coll().update_one(
+                {'collection': collection_name, 'symbol': symbol},
+                {'$set': {'intervals': [[s.to_pydatetime(), e.to_pydatetime()] for s, e in kept]}},
+                upsert=True,
+            )
+        else:
+            self._coverage_coll().delete_one(
+                {'collection': collection_name, 'symbol': symbol})
+
+    def seed_coverage_if_empty(self, collection_name, symbol) -> None:
+        """
+        coverage_meta 还没有该标的的记录、但集合里已有存量数据时，用存量
+        的 min/max datetime 补一条覆盖区间（两次带索引的 find_one，不拉
+        数据）。这是对启用覆盖元数据之前入库的历史的一次性迁移：没有它，
+        首次查询会把整个区间当缺口从数据源整段重拉。
+        """
+        if self.get_coverage(collection_name, symbol):
+            return
+        coll = self.db[collection_name]
+        first = coll.find_one({'symbol': symbol}, {'datetime': 1},
+                              sort=[('datetime', ASCENDING)])
+        if not first or 'datetime' not in first:
+            return
+        last = coll.find_one({'symbol': symbol}, {'datetime': 1},
+                             sort=[('datetime', DESCENDING)])
+        self.add_coverage(collection_name, symbol, first['datetime'], last['datetime'])
+
+    def coverage_missing(self, collection_name, symbol, start, end):
+        """
+        返回 [start, end] 内未覆盖的缺口列表 [(gap_start, gap_end), ...]。
+        区间中部的洞（历史上漏拉的段）同样会被报出来。
+        """
+        start = pd.to_datetime(start)
+        end = pd.to_datetime(end)
+        one_day = pd.Timedelta(days=1)
+        gaps = []
+        cursor = start
+        for s, e in self.get_coverage(collection_name, symbol):
+            if e < cursor:
+                continue
+            if s > end:
+                break
+            if s > cursor:
+                gaps.append((cursor, min(s - one_day, end)))
+            cursor = e + one_day
+            if cursor > end:
+                break
+        if cursor <= end:
+            gaps.append((cursor, end))
+        return gaps
 
-    def insert_data(self, collection_name, data):
+    def insert_data(self, collection_name, data, chunk_size=1000):
         """
-        写入行情数据
+        写入行情数据（批量 upsert）
         data 可以是 dict 或 list[dict] 或 pandas DataFrame
         必须包含 'symbol' 和 'datetime' 字段
+
+        以 (symbol, datetime) 为键做无序批量 upsert：重复数据更新而不是
+        整批报错丢弃（旧实现 insert_many(ordered=False) 遇重复抛
+        BulkWriteError，被裸 except 吞掉后整批丢失）。
+        按 chunk_size 分块提交，全量刷新不会在内存里堆一个巨型操作列表。
+        返回 {'inserted': n, 'updated': n, 'unchanged': n, 'errors': n}。
         """
         collection = self.db[collection_name]
-        
+
         if isinstance(data, pd.DataFrame):
             data = data.to_dict('records')
         elif isinstance(data, dict):
@@ -47,19 +264,72 @@ class MarketDataDB:
                     # pandas.Timestamp / numpy.datetime64 / str 等统一处理
                     d['datetime'] = pd.to_datetime(ts).to_pydatetime()
 
-        try:
-            collection.insert_many(data, ordered=False)
-        except DuplicateKeyError:
-            pass  # 已存在的忽略
-        except Exception as e:
-            print(f"插入数据失败: {e}")
+        counts = {'inserted': 0, 'updated': 0, 'unchanged': 0, 'errors': 0}
+        for i in range(0, len(data), chunk_size):
+            chunk = data[i:i + chunk_size]
+            ops = [
+                UpdateOne(
+                    {'symbol': d.get('symbol'), 'datetime': d.get('datetime')},
+                    {'$set': d},
+                    upsert=True,
+                )
+                for d in chunk
+            ]
+            try:
+                result = collection.bulk_write(ops, ordered=False)
+                counts['inserted'] += result.upserted_count
+                counts['updated'] += result.modified_count
+                counts['unchanged'] += result.matched_count - result.modified_count
+            except BulkWriteError as e:
+                detail = e.details or {}
+                counts['inserted'] += detail.get('nUpserted', 0)
+                counts['updated'] += detail.get('nModified', 0)
+                errors = detail.get('writeErrors', [])
+                counts['errors'] += len(errors)
+                print(f"批量写入部分失败 ({len(errors)} 条): {errors[:3]}")
+
+        # 同步覆盖元数据：按标的登记本次写入的时间跨度
+        spans = {}
+        for d in data:
+            sym, ts = d.get('symbol'), d.get('datetime')
+            if sym is None or ts is None:
+                continue
+            lo, hi = spans.get(sym, (ts, ts))
+            spans[sym] = (min(lo, ts), max(hi, ts))
+        for sym, (lo, hi) in spans.items():
+            self.add_coverage(collection_name, sym, lo, hi)
+        return counts
+
+    def _find_frame(self, collection_name, query, sort, limit=0, batch_size=10000) -> pd.DataFrame:
+        """
+        按固定 K线模式把查询结果解码为类型化 DataFrame。
+        优先走 pymongoarrow 的列式解码；否则单遍按列累积（不落 list[dict]）。
+        """
+        collection = self.db[collection_name]
+        if _HAS_PYMONGOARROW:
+            kwargs = dict(sort=sort, projection={'_id': False})
+            if limit > 0:
+                kwargs['limit'] = limit
+            df = find_pandas_all(collection, query, **kwargs)
+            return _coerce_kline_dtypes(df)
 
-    def query_data(self, collection_name, symbol=None, start=None, end=None, limit=0, sort=[('datetime', ASCENDING)]):
+        cursor = (
+            collection.find(query, {'_id': False})
+            .sort(sort)
+            .batch_size(batch_size)
+        )
+        if limit > 0:
+            cursor = cursor.limit(limit)
+        return _decode_cursor_columnar(cursor, list(KLINE_SCHEMA.keys()))
+
+    def query_data(self, collection_name, symbol=None, start=None, end=None, limit=0, sort=[('datetime', ASCENDING)], as_frame=False):
         """
         查询行情数据
         symbol: 交易品种，如 'BTCUSDT'
         start, end: datetime 或字符串
         limit: 返回条数，0 表示全部
+        as_frame: True 则直接解码为类型化 DataFrame（固定 K线模式，
+                  跳过逐文档 dict 中间态）；False 保持 list[dict] 旧行为
         """
         collection = self.db[collection_name]
         query = {}
@@ -73,11 +343,33 @@ class MarketDataDB:
             if end:
                 query['datetime']['$lte'] = pd.to_datetime(end).to_pydatetime()
 
+        if as_frame:
+            return self._find_frame(collection_name, query, sort, limit=limit)
+
         cursor = collection.find(query).sort(sort)
         if limit > 0:
             cursor = cursor.limit(limit)
         return list(cursor)
 
+    def query_many(self, collection_name, symbols, start=None, end=None, batch_size=10000):
+        """
+        批量查询多标的行情：单次 $in 查询代替逐 symbol 的 N 次往返。
+        symbols: 代码列表
+        start, end: datetime 或字符串
+        batch_size: 游标批大小，大批量拉取减少网络往返
+        返回按 (symbol, datetime) 排序的单个 DataFrame（无 _id 列，数值列已转型）。
+        """
+        query = {'symbol': {'$in': [str(s) for s in symbols]}}
+        if start or end:
+            query['datetime'] = {}
+            if start:
+                query['datetime']['$gte'] = pd.to_datetime(start).to_pydatetime()
+            if end:
+                query['datetime']['$lte'] = pd.to_datetime(end).to_pydatetime()
+
+        sort = [('symbol', ASCENDING), ('datetime', ASCENDING)]
+        return self._find_frame(collection_name, query, sort, batch_size=batch_size)
+
     def delete_data(self, collection_name, symbol=None, start=None, end=None):
         """
         删除数据：可按 symbol 与时间范围过滤；返回删除条数
@@ -93,6 +385,12 @@ class MarketDataDB:
             if end:
                 query['datetime']['$lte'] = pd.to_datetime(end).to_pydatetime()
         result = collection.delete_many(query)
+
+        # 同步覆盖元数据；不指定 symbol 的跨标的删除保守地清掉整集合的记录
+        if symbol:
+            self.remove_coverage(collection_name, symbol, start=start, end=end)
+        else:
+            self._coverage_coll().delete_many({'collection': collection_name})
         return result.deleted_count
 
 # --------------------------
@@ -0,0 +1,167 @@
+"""
+K线集合的本地 Parquet 镜像：
+- 每晚批量回测反复读取的都是不变历史，首次从 Mongo 拉取后落到本地
+  Parquet，之后的重复读取走内存映射扫描，不再产生 Mongo I/O
+- 目录布局：{mirror_dir}/{collection}/{symbol}.parquet，覆盖区间记在
+  {collection}/coverage/{symbol}.json（每标的一个文件：并行批跑时不同
+  标的的写入互不触碰，没有共享文件的读-改-写竞态）
+- 所有落盘都走"唯一临时名 + os.replace"：多个 worker 进程并发写同一
+  标的时各写各的临时文件，最后一个 replace 胜出，读者永远看到完整文件
+- refresh_stock_data / delete_stock_data 改写数据时按 symbol 失效
+"""
+import json
+import os
+import tempfile
+from pathlib import Path
+
+import pandas as pd
+
+try:
+    import pyarrow.parquet as pq
+    _HAS_PYARROW = True
+except ImportError:
+    _HAS_PYARROW = False
+
+# 镜像根目录：可用环境变量重定向（批量机上放到本地 SSD）
+DEFAULT_MIRROR_DIR = os.environ.get('KLINE_MIRROR_DIR', 'parquet_mirror')
+
+
+class ParquetMirror:
+    def __init__(self, mirror_dir: str = DEFAULT_MIRROR_DIR):
+        self.root = Path(mirror_dir)
+
+    # ---------- 内部工具 ----------
+    def _symbol_path(self, collection: str, symbol: str) -> Path:
+        return self.root / collection / f"{symbol}.parquet"
+
+    def _coverage_path(self, collection: str, symbol: str) -> Path:
+        return self.root / collection / "coverage" / f"{symbol}.json"
+
+    @staticmethod
+    def _atomic_replace(write_fn, path: Path) -> None:
+        """唯一临时名写入后 os.replace：并发写同一目标互不踩踏。"""
+        path.parent.mkdir(parents=True, exist_ok=True)
+        fd, tmp = tempfile.mkstemp(dir=path.parent, prefix=path.name, suffix='.tmp')
+        os.close(fd)
+        try:
+            write_fn(tmp)
+            os.replace(tmp, path)
+        except BaseException:
+            if os.path.exists(tmp):
+                os.unlink(tmp)
+            raise
+
+    def _load_coverage(self, collection: str, symbol: str):
+        path = self._coverage_path(collection, symbol)
+        if not path.exists():
+            return None
+        try:
+            with open(path, 'r', encoding='utf-8') as f:
+                return json.load(f)
+        except Exception:
+            return None
+
+    def _save_coverage(self, collection: str, symbol: str, cov: dict) -> None:
+        self._atomic_replace(
+            lambda tmp: Path(tmp).write_text(json.dumps(cov), encoding='utf-8'),
+            self._coverage_path(collection, symbol),
+        )
+
+    # ---------- 读 ----------
+    def get(self, collection: str, symbol: str, start, end):
+        """
+        镜像命中则返回 [start, end] 范围内的 DataFrame，未覆盖返回 None。
+        读取用 pyarrow memory_map，重复扫描几乎零拷贝。
+        """
+        symbol = str(symbol)
+        coverage = self._load_coverage(collection, symbol)
+        if not coverage:
+            return None
+
+        start_dt = pd.to_datetime(start)
+        end_dt = pd.to_datetime(end)
+        cov_start = pd.to_datetime(coverage['start'])
+        cov_end = pd.to_datetime(coverage['end'])
+        if start_dt < cov_start or end_dt > cov_end:
+            return None  # 区间未完全覆盖，回退 Mongo
+
+        path = self._symbol_path(collection, symbol)
+        if not path.exists():
+            return None
+
+        if _HAS_PYARROW:
+            df = pq.read_table(path, memory_map=True).to_pandas()
+        else:
+            df = pd.read_parquet(path)
+        if 'datetime' in df.columns:
+            df['datetime'] = pd.to_datetime(df['datetime'])
+            df = df[(df['datetime'] >= start_dt) & (df['datetime'] <= end_dt)]
+        return df.reset_index(drop=True)
+
+    # ---------- 写 ----------
+    def put(self, collection: str, symbol: str, df: pd.DataFrame, start, end) -> None:
+        """
+        把一次 Mongo 读取的结果并入镜像，并更新覆盖区间。
+        与既有数据按 datetime 去重合并；新旧区间不相邻时保留较大的一段，
+        避免把中间有洞的范围标成已覆盖。
+        """
+        if df is None or df.empty or 'datetime' not in df.columns:
+            return
+        symbol = str(symbol)
+        start_dt = pd.to_datetime(start)
+        end_dt = pd.to_datetime(end)
+
+        path = self._symbol_path(collection, symbol)
+        old = self._load_coverage(collection, symbol)
+
+        merged = df.copy()
+        merged['datetime'] = pd.to_datetime(merged['datetime'])
+
+        if old and path.exists():
+            old_start = pd.to_datetime(old['start'])
+            old_end = pd.to_datetime(old['end'])
+            # 相邻或重叠（留 5 天余量容纳休市）才能合并为单一覆盖区间
+            if start_dt <= old_end + pd.Timedelta(days=5) and end_dt >= old_start - pd.Timedelta(days=5):
+                existing = pd.read_parquet(path)
+                existing['datetime'] = pd.to_datetime(existing['datetime'])
+                merged = pd.concat([existing, merged], ignore_index=True)
+                merged = merged.drop_duplicates(subset=['datetime'], keep='last')
+                start_dt = min(start_dt, old_start)
+                end_dt = max(end_dt, old_end)
+            elif (old_end - old_start) > (end_dt - start_dt):
+                return  # 旧覆盖更大，保留旧数据
+
+        merged = merged.sort_values('datetime').reset_index(drop=True)
+        self._atomic_replace(lambda tmp: merged.to_parquet(tmp, index=False), path)
+        self._save_coverage(collection, symbol,
+                            {'start': str(start_dt.date()), 'end': str(end_dt.date())})
+
+    # ---------- 失效 ----------
+    def invalidate(self, symbol: str = None, collection: str = None) -> None:
+        """删除指定 symbol（或全部）的镜像分区与覆盖记录。"""
+        if not self.root.exists():
+            return
+        collections = [collection] if collection else [p.name for p in self.root.iterdir() if p.is_dir()]
+        for coll in collections:
+            if symbol:
+                symbols = {str(symbol)}
+            else:
+                symbols = {p.stem for p in (self.root / coll).glob('*.parquet')}
+                cov_dir = self.root / coll / 'coverage'
+                if cov_dir.exists():
+                    symbols |= {p.stem for p in cov_dir.glob('*.json')}
+            for sym in symbols:
+                for path in (self._symbol_path(coll, sym), self._coverage_path(coll, sym)):
+                    if path.exists():
+                        path.unlink()
+
+
+# 进程内默认镜像实例
+_default_mirror = None
+
+
+def get_mirror() -> ParquetMirror:
+    global _default_mirror
+    if _default_mirror is None:
+        _default_mirror = ParquetMirror()
+    return _default_mirror
@@ -1,6 +1,38 @@
 import akshare as ak
 import pandas as pd
 from marketdata_db import MarketDataDB
+from parquet_mirror import get_mirror
+
+# 数据被重写/删除时的回调（如上层行情缓存失效），入参为 symbol
+_refresh_listeners = []
+
+# 周/月线重采样规则：周线以周五收束（A股周K习惯），月线以自然月收束，
+# 时间戳取周期内最后一个实际交易日
+_RESAMPLE_RULES = {'weekly': 'W-FRI', 'monthly': 'M'}
+# 重采样结果的物化缓存：键 (symbol, period, start, end)，日线变动时失效
+_resample_cache = {}
+
+
+def register_refresh_listener(fn) -> None:
+    """注册回调：refresh_stock_data / delete_stock_data 改写某标的后调用 fn(symbol)。"""
+    if fn not in _refresh_listeners:
+        _refresh_listeners.append(fn)
+
+
+def _notify_refresh(symbol: str) -> None:
+    # 数据被改写，对应镜像分区必须失效
+    try:
+        get_mirror().invalidate(symbol=symbol)
+    except Exception as e:
+        print(f"镜像失效失败 {symbol}: {e}")
+    # 日线变了，基于它重采样的周/月线缓存全部作废
+    for key in [k for k in _resample_cache if k[0] == symbol]:
+        _resample_cache.pop(key, None)
+    for fn in _refresh_listeners:
+        try:
+            fn(symbol)
+        except Exception as e:
+            print(f"refresh 回调执行失败 {symbol}: {e}")
 
 
 def _normalize_kline_df(df: pd.DataFrame, symbol: str) -> pd.DataFrame:
@@ -35,53 +67,111 @@ def _fetch_and_insert_range(db: MarketDataDB, collection: str, symbol: str, star
     if isinstance(api_df, pd.DataFrame) and not api_df.empty:
         api_df = _normalize_kline_df(api_df, symbol)
         db.insert_data(collection, api_df)
+    # 登记整个请求区间（而非数据 min/max）：拉回来为空的纯节假日/停牌段
+    # 也算覆盖过，避免下次重复拉取
+    db.add_coverage(collection, symbol, start_dt, end_dt)
 
 
 def _get_kline(symbol: str, start_date: str, end_date: str, period: str, collection: str) -> pd.DataFrame:
-    db = MarketDataDB()
+    # 先试本地 Parquet 镜像：命中则完全不碰 Mongo
+    mirror = get_mirror()
+    cached = mirror.get(collection, symbol, start_date, end_date)
+    if cached is not None:
+        return cached
+
+    # 共享连接：整个进程复用同一个客户端连接池，索引只确认一次
+    db = MarketDataDB.shared()
     db.ensure_index(collection, unique=True)
 
-    # 先查库
-    result = db.query_data(collection, symbol=symbol, start=start_date, end=end_date)
     start_dt = pd.to_datetime(start_date)
     end_dt = pd.to_datetime(end_date)
 
-    if not result:
-        # 库内无数据，拉全量
-        _fetch_and_insert_range(db, collection, symbol, start_dt, end_dt, period)
-    else:
-        df_exist = pd.DataFrame(result)
-        if 'datetime' in df_exist.columns:
-            df_exist['datetime'] = pd.to_datetime(df_exist['datetime'])
-            min_dt = df_exist['datetime'].min()
-            max_dt = df_exist['datetime'].max()
-
-            # 左端缺口
-            if start_dt < min_dt:
-                _fetch_and_insert_range(db, collection, symbol, start_dt, min_dt - pd.Timedelta(days=1), period)
-            # 右端缺口
-            if end_dt > max_dt:
-                _fetch_and_insert_range(db, collection, symbol, max_dt + pd.Timedelta(days=1), end_dt, period)
-
-    # 统一从库返回
-    final = db.query_data(collection, symbol=symbol, start=start_date, end=end_date)
-    df_final = pd.DataFrame(final)
-    if '_id' in df_final.columns:
-        df_final = df_final.drop(columns=['_id'])
-    if 'datetime' in df_final.columns:
-        df_final['datetime'] = pd.to_datetime(df_final['datetime'])
+    # 覆盖元数据启用前入库的历史：首次碰到时用存量 min/max 补登记，
+    # 避免把整个区间当缺口整段重拉
+    db.seed_coverage_if_empty(collection, symbol)
+
+    # 查覆盖元数据定位缺口：一次 O(1) 查询代替全量拉取算 min/max，
+    # 且区间中部的洞（历史漏拉段）也能被发现并补齐
+    for gap_start, gap_end in db.coverage_missing(collection, symbol, start_dt, end_dt):
+        _fetch_and_insert_range(db, collection, symbol, gap_start, gap_end, period)
+
+    # 统一从库返回：列式解码直接出类型化 DataFrame（无 _id、数值列已转型），
+    # 不再走 list[dict] -> DataFrame 的逐文档路径
+    df_final = db.query_data(collection, symbol=symbol, start=start_date, end=end_date, as_frame=True)
+
+    # 回填镜像，下次同区间读取直接走本地
+    mirror.put(collection, symbol, df_final, start_date, end_date)
     return df_final
 
+def _resample_kline(daily_df: pd.DataFrame, rule: str) -> pd.DataFrame:
+    """
+    把日线聚合成周/月线：OHLC 分别取 first/max/min/last，量额求和，
+    时间戳落在周期内最后一个交易日上；涨跌幅/振幅按聚合后前收重算。
+    """
+    if daily_df is None or daily_df.empty or 'datetime' not in daily_df.columns:
+        return daily_df
+    df = daily_df.sort_values('datetime')
+    period_key = df['datetime'].dt.to_period(rule)
+    spec = {
+        'datetime': ('datetime', 'last'),
+        'symbol': ('symbol', 'last'),
+        'stock_code': ('stock_code', 'last'),
+        'open': ('open', 'first'),
+        'high': ('high', 'max'),
+        'low': ('low', 'min'),
+        'close': ('close', 'last'),
+        'volume': ('volume', 'sum'),
+        'turnover': ('turnover', 'sum'),
+        'turnover_rate': ('turnover_rate', 'sum'),
+    }
+    spec = {k: v for k, v in spec.items() if v[0] in df.columns}
+    out = df.groupby(period_key).agg(**spec).reset_index(drop=True)
+
+    # 跨周期指标按聚合后的前收重算（首根无前收为 NaN）
+    prev_close = out['close'].shift(1)
+    out['change'] = out['close'] - prev_close
+    out['pct_change'] = out['change'] / prev_close * 100
+    out['amplitude'] = (out['high'] - out['low']) / prev_close * 100
+    return out
+
+
+def _get_resampled(symbol: str, start_date: str, end_date: str, period: str) -> pd.DataFrame:
+    """
+    周/月线统一从 daily_kline 就地重采样，不再单独拉取/单独存储，
+    三个周期天然同源一致。结果缓存在进程内，日线刷新时自动失效。
+    """
+    key = (symbol, period, str(start_date), str(end_date))
+    cached = _resample_cache.get(key)
+    if cached is not None:
+        return cached.copy()
+
+    start_dt = pd.to_datetime(start_date)
+    end_dt = pd.to_datetime(end_date)
+    # 向前多取一段日线，保证首根周/月线聚合的是完整周期
+    if period == 'weekly':
+        fetch_start = start_dt - pd.Timedelta(days=6)
+    else:
+        fetch_start = start_dt.replace(day=1)
+
+    daily = get_stock_daily_data(symbol, fetch_start.strftime('%Y%m%d'), end_dt.strftime('%Y%m%d'))
+    out = _resample_kline(daily, _RESAMPLE_RULES[period])
+    if out is not None and not out.empty and 'datetime' in out.columns:
+        out = out[(out['datetime'] >= start_dt) & (out['datetime'] <= end_dt)].reset_index(drop=True)
+
+    _resample_cache[key] = out
+    return out.copy() if out is not None else out
+
+
 def get_stock_daily_data(symbol, start_date, end_date):
     return _get_kline(symbol, start_date, end_date, period="daily", collection='daily_kline')
 
 
 def get_stock_weekly_data(symbol, start_date, end_date):
-    return _get_kline(symbol, start_date, end_date, period="weekly", collection='weekly_kline')
+    return _get_resampled(symbol, start_date, end_date, period="weekly")
 
 
 def get_stock_monthly_data(symbol, start_date, end_date):
-    return _get_kline(symbol, start_date, end_date, period="monthly", collection='monthly_kline')
+    return _get_resampled(symbol, start_date, end_date, period="monthly")
 
 if __name__ == "__main__":
     symbol = '000001'
@@ -114,8 +204,10 @@ def delete_stock_data(symbol: str, start_date: str = None, end_date: str = None,
     collection = collection_map.get(period)
     if not collection:
         raise ValueError(f"unsupported period: {period}")
-    db = MarketDataDB()
-    return db.delete_data(collection, symbol=symbol, start=start_date, end=end_date)
+    db = MarketDataDB.shared()
+    deleted = db.delete_data(collection, symbol=symbol, start=start_date, end=end_date)
+    _notify_refresh(symbol)
+    return deleted
 
 
 def refresh_stock_data(symbols, start_date: str, end_date: str, period: str = "daily") -> None:
@@ -124,7 +216,7 @@ def refresh_stock_data(symbols, start_date: str, end_date: str, period: str = "d
     """
     if isinstance(symbols, (str,)):
         symbols = [symbols]
-    db = MarketDataDB()
+    db = MarketDataDB.shared()
     collection_map = {
         'daily': 'daily_kline',
         'weekly': 'weekly_kline',
@@ -137,4 +229,5 @@ def refresh_stock_data(symbols, start_date: str, end_date: str, period: str = "d
         # 先删除
         db.delete_data(collection, symbol=sym, start=start_date, end=end_date)
         # 再重拉
-        _fetch_and_insert_range(db, collection, sym, pd.to_datetime(start_date), pd.to_datetime(end_date), period)
\ No newline at end of file
+        _fetch_and_insert_range(db, collection, sym, pd.to_datetime(start_date), pd.to_datetime(end_date), period)
+        _notify_refresh(sym)
\ No newline at end of file
@@ -1,4 +1,4 @@
-from backtest import run_ma_grid_batch
+from backtest import run_ma_grid_batch, ResultsDB
 
 
 if __name__ == '__main__':
@@ -8,6 +8,7 @@ if __name__ == '__main__':
     end_date = '20250901'
     fast_list = [5, 10, 20]
     slow_list = [30, 50, 100]
+    store_dir = 'ma_grid_store'
 
     df = run_ma_grid_batch(
         symbols_file=symbols_file,
@@ -20,9 +21,16 @@ if __name__ == '__main__':
         commission=0.001,
         cheat_on_close=True,
         out_csv='batch_results.csv',
+        store_dir=store_dir,
     )
 
-    if df is not None and not df.empty:
+    # 摘要走结果库查询接口，不再重排整个结果帧
+    db = ResultsDB(store_dir)
+    top = db.top_overall(metric='sharpe', n=20)
+    if top is not None and not top.empty:
+        print('—— 夏普前 20（全库）——')
+        print(top.round(2))
+    elif df is not None and not df.empty:
         print(df.round(2).head(20))
     else:
         print('无输出（可能 symbols.csv 无待回测标的）')
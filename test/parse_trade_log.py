@@ -3,64 +3,91 @@ import re
 import os
 from datetime import datetime, date
 
-def parse_trade_log(log_file_path):
-    """解析交易日志文件"""
-    # 用正则匹配调仓行（形如 6位数字+.SZ/.SH 开头）
-    pattern = re.compile(r"^\d{6}\.(SZ|SH)\|")
-    
-    # 读取日志文件，提取调仓行
-    lines = []
-    try:
-        with open(log_file_path, "r", encoding="utf-8") as f:
-            for line in f:
-                line = line.strip()
-                if pattern.match(line):
-                    lines.append(line)
-    except FileNotFoundError:
-        print(f"日志文件未找到: {log_file_path}")
+# 调仓行形如 6位数字+.SZ/.SH 开头
+_TRADE_LINE_RE = re.compile(r"^\d{6}\.(?:SZ|SH)\|")
+_TRADE_COLUMNS = ["symbol", "delta", "date", "time", "v1", "v2", "price"]
+# 每块大约读入的字节数（readlines 按整行对齐），多 GB 日志内存仍有界
+CHUNK_BYTES = 8 * 1024 * 1024
+
+
+def _parse_chunk(lines):
+    """
+    对一块行做向量化的过滤 + 切分 + 数字化（pandas str 运算，不逐行回 Python）。
+    返回该块的调仓记录 DataFrame，块内无调仓行时返回 None。
+    """
+    s = pd.Series(lines, dtype="object").str.strip()
+    s = s[s.str.match(_TRADE_LINE_RE)]
+    if s.empty:
         return None
-    
-    if not lines:
+    parts = s.str.split("|", expand=True)
+    if parts.shape[1] < len(_TRADE_COLUMNS):
+        return None
+    parts = parts.iloc[:, :len(_TRADE_COLUMNS)]
+    parts.columns = _TRADE_COLUMNS
+    # 数字列在块内就转掉，字符串不拖到最终合并
+    for col in ("delta", "price", "v1"):
+        parts[col] = pd.to_numeric(parts[col], errors="coerce")
+    return parts
+
+
+def parse_trade_logs(log_file_paths, chunk_bytes=CHUNK_BYTES):
+    """
+    流式解析一个或多个交易日志，合并为单个类型化 DataFrame：
+    - 按块读取（每块 ~chunk_bytes，整行对齐），整段日志不落内存
+    - 每块向量化过滤 + 切分，symbol/side 用 categorical 存储
+    没有任何调仓记录时返回 None。
+    """
+    if isinstance(log_file_paths, (str, os.PathLike)):
+        log_file_paths = [log_file_paths]
+
+    chunks = []
+    for path in log_file_paths:
+        try:
+            with open(path, "r", encoding="utf-8") as f:
+                while True:
+                    lines = f.readlines(chunk_bytes)
+                    if not lines:
+                        break
+                    parsed = _parse_chunk(lines)
+                    if parsed is not None:
+                        chunks.append(parsed)
+        except FileNotFoundError:
+            print(f"日志文件未找到: {path}")
+            continue
+
+    if not chunks:
         print("未找到调仓记录")
         return None
-    
-    # 转成 DataFrame
-    df = pd.DataFrame([l.split("|") for l in lines],
-                      columns=["symbol", "delta", "date", "time", "v1", "v2", "price"])
-    
-    # 转数字
-    df["delta"] = pd.to_numeric(df["delta"], errors="coerce")
-    df["price"] = pd.to_numeric(df["price"], errors="coerce")
-    df["v1"] = pd.to_numeric(df["v1"], errors="coerce")
-    
+
+    df = pd.concat(chunks, ignore_index=True)
+    df["symbol"] = df["symbol"].astype("category")
+
     # 计算金额和方向
-    df["side"] = df["delta"].apply(lambda x: "buy" if x > 0 else "sell")
-    df["amount"] = abs(df["delta"]) * df["price"]
-    
+    df["side"] = (df["delta"] > 0).map({True: "buy", False: "sell"}).astype("category")
+    df["amount"] = df["delta"].abs() * df["price"]
+
     # v1是交易前持仓，计算交易后的持仓
     df["position_after"] = df["v1"] + df["delta"]
-    
     return df
 
+
+def parse_trade_log(log_file_path):
+    """解析单个交易日志文件（多文件版见 parse_trade_logs）"""
+    return parse_trade_logs(log_file_path)
+
 def generate_trade_report(df, output_date):
     """生成交易报告并保存为CSV"""
     if df is None or df.empty:
         return
     
     # 当前仓位汇总
-    pos_summary = df.groupby("symbol")["delta"].sum().reset_index()
+    pos_summary = df.groupby("symbol", observed=True)["delta"].sum().reset_index()
     pos_summary.columns = ["symbol", "position"]
     pos_summary = pos_summary[pos_summary["position"] != 0]  # 只保留非零仓位
-    
-    # 使用日志中的最新价格计算市值
-    prices = {}
-    for symbol in pos_summary["symbol"]:
-        symbol_trades = df[df["symbol"] == symbol]
-        if not symbol_trades.empty:
-            prices[symbol] = symbol_trades["price"].iloc[-1]  # 使用最后一次交易的价格
-    
-    # 计算市值
-    pos_summary["current_price"] = pos_summary["symbol"].map(prices)
+
+    # 使用日志中的最新价格计算市值：一次分组 last 代替逐 symbol 过滤
+    last_prices = df.groupby("symbol", observed=True)["price"].last()
+    pos_summary["current_price"] = pos_summary["symbol"].map(last_prices)
     pos_summary = pos_summary.dropna(subset=["current_price"])
     pos_summary["market_value"] = abs(pos_summary["position"]) * pos_summary["current_price"]
     
@@ -1,12 +1,99 @@
+import os
+from datetime import datetime
+from pathlib import Path
+
 import akshare as ak
 import pandas as pd
-from datetime import datetime
 
-def pick_stocks(top_n=None):
-    # 获取当天A股行情（东方财富 A 股实时行情）
-    stock_df = ak.stock_zh_a_spot_em()
+# 打分用到的字段：这些没变就认为该股快照没变，不触发重打分
+SCORE_FIELDS = ["量比", "换手率", "流通市值", "涨跌幅"]
+OUTPUT_FIELDS = ["最新价", "成交额"]
+
+
+class SnapshotStore:
+    """
+    全市场实时行情的本地快照库（列式存储）：
+    - current.parquet 始终是最新全量快照（tmp + os.replace 原子覆盖）
+    - history/ 下每次有变化就追加一个只含变化行的增量 parquet，
+      盘中快照历史可按时间直接查询，不再整读整写一个越滚越大的 CSV
+    - scores.parquet 缓存上一次的打分结果，行情没变时直接复用
+    """
+
+    def __init__(self, store_dir="spot_snapshots"):
+        self.root = Path(store_dir)
+        self.history_dir = self.root / "history"
+        self.history_dir.mkdir(parents=True, exist_ok=True)
+        self.current_path = self.root / "current.parquet"
+        self.scores_path = self.root / "scores.parquet"
+
+    def _atomic_write(self, df: pd.DataFrame, path: Path) -> None:
+        tmp = path.with_suffix(path.suffix + ".tmp")
+        df.to_parquet(tmp, index=False)
+        os.replace(tmp, path)
+
+    def load_current(self):
+        if not self.current_path.exists():
+            return None
+        return pd.read_parquet(self.current_path)
+
+    def diff_codes(self, new_df: pd.DataFrame, prev_df) -> set:
+        """返回打分字段有变化（含新增/退出）的代码集合。"""
+        if prev_df is None:
+            return set(new_df["代码"])
+        merged = new_df[["代码"] + SCORE_FIELDS].merge(
+            prev_df[["代码"] + SCORE_FIELDS],
+            on="代码", how="outer", suffixes=("", "_prev"), indicator=True,
+        )
+        changed = merged["_merge"] != "both"
+        for col in SCORE_FIELDS:
+            changed |= ~(
+                (merged[col] == merged[f"{col}_prev"])
+                | (merged[col].isna() & merged[f"{col}_prev"].isna())
+            )
+        return set(merged.loc[changed, "代码"])
+
+    def update(self, new_df: pd.DataFrame) -> set:
+        """
+        写入一次抓取：与上一快照做字段级 diff，有变化才落盘。
+        增量文件只含变化行，current 全量覆盖。返回变化代码集合。
+        """
+        snap_time = datetime.now()
+        new_df = new_df.copy()
+        new_df["快照时间"] = snap_time.strftime("%Y-%m-%d %H:%M:%S")
+
+        changed = self.diff_codes(new_df, self.load_current())
+        if not changed:
+            return changed
+
+        delta = new_df[new_df["代码"].isin(changed)]
+        delta_path = self.history_dir / f"snap_{snap_time.strftime('%Y%m%d_%H%M%S')}.parquet"
+        self._atomic_write(delta, delta_path)
+        self._atomic_write(new_df, self.current_path)
+        return changed
 
-    # 基础过滤条件
+    def load_history(self, start=None, end=None) -> pd.DataFrame:
+        """按快照时间查询盘中历史（增量行的拼接）。"""
+        files = sorted(self.history_dir.glob("snap_*.parquet"))
+        if not files:
+            return pd.DataFrame()
+        df = pd.concat([pd.read_parquet(f) for f in files], ignore_index=True)
+        if start:
+            df = df[df["快照时间"] >= str(start)]
+        if end:
+            df = df[df["快照时间"] <= str(end)]
+        return df
+
+    def load_scores(self):
+        if not self.scores_path.exists():
+            return None
+        return pd.read_parquet(self.scores_path)
+
+    def save_scores(self, df: pd.DataFrame) -> None:
+        self._atomic_write(df, self.scores_path)
+
+
+def score_snapshot(stock_df: pd.DataFrame, top_n=None) -> pd.DataFrame:
+    """四项过滤 + 百分位打分，作用在存储表上（与抓取解耦，可离线重算）。"""
     df = stock_df[
         (stock_df["量比"] > 2.5) &                      # 量比放大
         (stock_df["换手率"] > 5) & (stock_df["换手率"] < 20) &   # 换手适中
@@ -35,35 +122,46 @@ def pick_stocks(top_n=None):
     # 按得分排序，取TopN
     df = df.sort_values("score", ascending=False).head(top_n)
 
-    return df[["选股时间","选股日期","代码","名称","最新价","涨跌幅","量比","换手率","流通市值","成交额","score"]]
+    return df[["选股时间", "选股日期", "代码", "名称", "最新价", "涨跌幅", "量比", "换手率", "流通市值", "成交额", "score"]]
+
+
+def pick_stocks(top_n=None, store_dir="spot_snapshots"):
+    """
+    盘中选股：抓取全市场快照 -> 与本地快照库 diff -> 只在有变化时重打分。
+    打分里的百分位排名是横截面量，任何入选字段变化都会牵动名次，
+    所以"变化"触发的是对存储表的整表重算（内存内，亚秒级）；
+    完全无变化的重跑直接复用缓存的打分结果，不碰任何计算。
+    """
+    store = SnapshotStore(store_dir)
+
+    # 获取当天A股行情（东方财富 A 股实时行情）
+    stock_df = ak.stock_zh_a_spot_em()
+
+    changed = store.update(stock_df)
+    if not changed:
+        cached = store.load_scores()
+        if cached is not None:
+            print("行情较上一快照无变化，复用缓存打分")
+            return cached.head(top_n) if top_n else cached
+
+    print(f"变化标的数: {len(changed)}，基于存储表重打分")
+    result = score_snapshot(store.load_current(), top_n=top_n)
+    if not result.empty:
+        store.save_scores(result)
+    return result
 
 
 if __name__ == "__main__":
     today = datetime.now().strftime("%Y-%m-%d")
     current_time = datetime.now().strftime("%Y%m%d_%H%M%S")
-    
+
     result = pick_stocks()
     if not result.empty:
         # 输出到CSV文件，按时间命名
         csv_filename = f"selected_stocks_{current_time}.csv"
         result.to_csv(csv_filename, index=False, encoding="utf-8-sig")
         print(f"\n选股结果已保存到文件: {csv_filename}")
-        
-        # 同时追加到历史记录文件
-        history_filename = "selected_stocks_history.csv"
-        try:
-            # 尝试读取现有历史文件
-            history_df = pd.read_csv(history_filename, encoding="utf-8-sig")
-            # 合并新结果
-            combined_df = pd.concat([history_df, result], ignore_index=True)
-        except FileNotFoundError:
-            # 如果历史文件不存在，直接使用当前结果
-            combined_df = result
-        
-        # 按选股时间排序（最新的在前）
-        combined_df = combined_df.sort_values("选股时间", ascending=False)
-        # 保存历史记录
-        combined_df.to_csv(history_filename, index=False, encoding="utf-8-sig")
-        print(f"历史记录已更新: {history_filename}")
+        # 历史不再整读整写 CSV：增量快照都在快照库里，按需查询
+        print("盘中快照历史可用 SnapshotStore().load_history() 查询（spot_snapshots/history/）")
     else:
         print("今日无符合条件的股票，未生成CSV文件")